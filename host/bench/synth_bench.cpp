@@ -0,0 +1,300 @@
+// Host benchmarks of the synth code paths - run build/synth_bench
+// Numbers are for the host CPU: use them to compare changes, not as on-board timings
+
+#include <benchmark/benchmark.h>
+#include <constants.h>
+#include <waveforms.h>
+#include <Voices.h>
+#include <Envelope.h>
+#include <Mixer.h>
+#include <Filter.h>
+#include <Knob.h>
+#include <State.h>
+#include <Profiler.h>
+#include <TraceRing.h>
+#include <KeyFrame.h>
+#include <KeyDebounce.h>
+#include <CanTxRing.h>
+
+//Naive per-sample generator - the int8 waveforms the synth used before the wavetables, kept here as the
+//baseline they are benchmarked against
+static const int8_t lut[256] = {
+   0,   3,   6,   9,  12,  16,  19,  22,  25,  28,
+  31,  34,  37,  40,  43,  46,  49,  51,  54,  57,
+  60,  63,  65,  68,  71,  73,  76,  78,  81,  83,
+  85,  88,  90,  92,  94,  96,  98, 100, 102, 104,
+ 106, 107, 109, 111, 112, 113, 115, 116, 117, 118,
+ 120, 121, 122, 122, 123, 124, 125, 125, 126, 126,
+ 126, 127, 127, 127, 127, 127, 127, 127, 126, 126,
+ 126, 125, 125, 124, 123, 122, 122, 121, 120, 118,
+ 117, 116, 115, 113, 112, 111, 109, 107, 106, 104,
+ 102, 100,  98,  96,  94,  92,  90,  88,  85,  83,
+  81,  78,  76,  73,  71,  68,  65,  63,  60,  57,
+  54,  51,  49,  46,  43,  40,  37,  34,  31,  28,
+  25,  22,  19,  16,  12,   9,   6,   3,   0,  -3,
+  -6,  -9, -12, -16, -19, -22, -25, -28, -31, -34,
+ -37, -40, -43, -46, -49, -51, -54, -57, -60, -63,
+ -65, -68, -71, -73, -76, -78, -81, -83, -85, -88,
+ -90, -92, -94, -96, -98,-100,-102,-104,-106,-107,
+-109,-111,-112,-113,-115,-116,-117,-118,-120,-121,
+-122,-122,-123,-124,-125,-125,-126,-126,-126,-127,
+-127,-127,-127,-127,-127,-127,-126,-126,-126,-125,
+-125,-124,-123,-122,-122,-121,-120,-118,-117,-116,
+-115,-113,-112,-111,-109,-107,-106,-104,-102,-100,
+ -98, -96, -94, -92, -90, -88, -85, -83, -81, -78,
+ -76, -73, -71, -68, -65, -63, -60, -57, -54, -51,
+ -49, -46, -43, -40, -37, -34, -31, -28, -25, -22,
+ -19, -16, -12,  -9,  -6,  -3 };
+
+static int32_t waveformGenerator(uint32_t phaseAcc, int waveSelect) {
+    int32_t scaledPhase = (phaseAcc >> 24) - 128;
+    if (waveSelect == 0) { return scaledPhase; }                                            // sawtooth
+    else if (waveSelect == 1) { return lut[(uint8_t)(scaledPhase + 128)]; }                 // sine
+    else if (waveSelect == 2) { return scaledPhase < 0 ? -128 : 127; }                      // square
+    else if (waveSelect == 3) { return 2 * (scaledPhase <= 0 ? scaledPhase + 64 : 64 - scaledPhase); } // triangle
+    else { return 0; }
+}
+
+//Naive per-sample generator, one waveform per argument
+static void BM_WaveformGenerator(benchmark::State& state) {
+    int waveSelect = state.range(0);
+    uint32_t phaseAcc = 0;
+    uint32_t stepSize = stepSizeFor(4, 9);
+    for (auto _ : state) {
+        phaseAcc += stepSize;
+        benchmark::DoNotOptimize(waveformGenerator(phaseAcc, waveSelect));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WaveformGenerator)->DenseRange(0, 3);
+
+//Band-limited table lookup as used by the mixer
+static void BM_WavetableLookup(benchmark::State& state) {
+    Wavetable table = selectWavetable(state.range(0), stepSizeFor(4, 9));
+    uint32_t phaseAcc = 0;
+    uint32_t stepSize = stepSizeFor(4, 9);
+    for (auto _ : state) {
+        phaseAcc += stepSize;
+        benchmark::DoNotOptimize(wavetableLookup(table.samples, table.bits, phaseAcc));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WavetableLookup)->DenseRange(0, 3);
+
+//Step size of a bent note, as joystickUpdateTask retunes every voice
+static void BM_VibratoFunc(benchmark::State& state) {
+    uint32_t bend = bendMultiplier(700);
+    int note = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(vibratoFunc(4, note, bend));
+        note = (note + 1) % 12;
+    }
+}
+BENCHMARK(BM_VibratoFunc);
+
+static void BM_BendMultiplier(benchmark::State& state) {
+    int32_t joyY = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bendMultiplier(joyY));
+        joyY = (joyY + 7) & 1023;
+    }
+}
+BENCHMARK(BM_BendMultiplier);
+
+static void fillVoices(MixVoice* voices, int count, int waveSelect) {
+    for (int v = 0; v < count; v++) {
+        uint32_t stepSize = stepSizeFor(2 + v / 12, v % 12);
+        Wavetable table = selectWavetable(waveSelect, stepSize);
+        voices[v] = {table.samples, table.bits, (uint32_t)v << 27, stepSize, 16384, 1};
+    }
+}
+
+//Per-sample voice loop - one block of SAMPLE_BUFFER_SIZE samples for 1 to ACCUMULATORS voices
+static void BM_MixVoices(benchmark::State& state) {
+    int count = state.range(0);
+    MixVoice voices[ACCUMULATORS];
+    int64_t out[SAMPLE_BUFFER_SIZE] = {0};
+    fillVoices(voices, count, 0);
+    for (auto _ : state) {
+        mixVoices(voices, count, out, SAMPLE_BUFFER_SIZE);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetItemsProcessed(state.iterations() * SAMPLE_BUFFER_SIZE);
+}
+BENCHMARK(BM_MixVoices)->RangeMultiplier(2)->Range(1, ACCUMULATORS);
+
+static void BM_MixVoicesScalar(benchmark::State& state) {
+    int count = state.range(0);
+    MixVoice voices[ACCUMULATORS];
+    int64_t out[SAMPLE_BUFFER_SIZE] = {0};
+    fillVoices(voices, count, 0);
+    for (auto _ : state) {
+        mixVoicesScalar(voices, count, out, SAMPLE_BUFFER_SIZE);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetItemsProcessed(state.iterations() * SAMPLE_BUFFER_SIZE);
+}
+BENCHMARK(BM_MixVoicesScalar)->RangeMultiplier(2)->Range(1, ACCUMULATORS);
+
+//Block rate work per voice - envelope step and table selection
+static void BM_EnvelopeAdvance(benchmark::State& state) {
+    Envelope envelopes[ACCUMULATORS];
+    EnvelopeRates rates = envelopeRates(4);
+    for (auto& envelope : envelopes) { envelope.noteOn(); }
+    for (auto _ : state) {
+        for (auto& envelope : envelopes) {
+            benchmark::DoNotOptimize(envelope.advance(rates));
+            if (envelope.isIdle()) { envelope.noteOn(); }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * ACCUMULATORS);
+}
+BENCHMARK(BM_EnvelopeAdvance);
+
+static void BM_FilterProcess(benchmark::State& state) {
+    StateVariableFilter filter;
+    filter.configure(FILTER_LOW, 64);
+    int32_t samples[SAMPLE_BUFFER_SIZE];
+    for (uint32_t n = 0; n < SAMPLE_BUFFER_SIZE; n++) { samples[n] = (n * 1024) - 32768; }
+    for (auto _ : state) {
+        filter.process(samples, SAMPLE_BUFFER_SIZE);
+        benchmark::DoNotOptimize(samples);
+    }
+    state.SetItemsProcessed(state.iterations() * SAMPLE_BUFFER_SIZE);
+}
+BENCHMARK(BM_FilterProcess);
+
+//Note list update as in playNotesTask - one press and release
+static void BM_NoteOnOff(benchmark::State& state) {
+    VoicePool pool(STEAL_OLDEST);
+    int note = 0;
+    for (auto _ : state) {
+        uint8_t octave = 4;
+        uint8_t voice = pool.noteOn(octave, note, stepSizeFor(octave, note));
+        pool.noteOff(octave, note);
+        pool.finish(voice);
+        note = (note + 1) % 12;
+    }
+}
+BENCHMARK(BM_NoteOnOff);
+
+//Note on with every voice sounding, so each press steals
+static void BM_NoteOnSteal(benchmark::State& state) {
+    VoicePool pool((VoiceSteal)state.range(0));
+    for (int i = 0; i < ACCUMULATORS; i++) { pool.noteOn(1 + i / 12, i % 12, stepSizeFor(1 + i / 12, i % 12)); }
+    int key = 0;
+    for (auto _ : state) {
+        uint8_t octave = 1 + key / 12;
+        benchmark::DoNotOptimize(pool.noteOn(octave, key % 12, stepSizeFor(octave, key % 12)));
+        key = (key + 1) % (12 * (OCTAVES - 1));
+    }
+}
+BENCHMARK(BM_NoteOnSteal)->Arg(STEAL_OLDEST)->Arg(STEAL_QUIETEST)->Arg(STEAL_SAME_NOTE);
+
+//Pitch bend applied to a full pool
+static void BM_Retune(benchmark::State& state) {
+    VoicePool pool(STEAL_OLDEST);
+    for (int i = 0; i < ACCUMULATORS; i++) { pool.noteOn(1 + i / 12, i % 12, stepSizeFor(1 + i / 12, i % 12)); }
+    for (auto _ : state) {
+        pool.retune(bendMultiplier(700), vibratoFunc);
+    }
+    state.SetItemsProcessed(state.iterations() * ACCUMULATORS);
+}
+BENCHMARK(BM_Retune);
+
+//Knob decoding from scanKeysTask
+static void BM_KnobUpdate(benchmark::State& state) {
+    Knob knob;
+    knob.setLowerLimit(0);
+    knob.setUpperLimit(8);
+    const bool sequence[4][2] = {{0, 0}, {0, 1}, {1, 1}, {1, 0}};
+    int step = 0;
+    for (auto _ : state) {
+        knob.updateRotation(sequence[step][0], sequence[step][1]);
+        step = (step + 1) % 4;
+    }
+}
+BENCHMARK(BM_KnobUpdate);
+
+static void BM_StateAccess(benchmark::State& state) {
+    SysState sysState;
+    for (auto _ : state) {
+        sysState.setVolume(sysState.getVolume() ^ 1);
+        benchmark::DoNotOptimize(sysState.getWaveform());
+    }
+}
+BENCHMARK(BM_StateAccess);
+
+//Receiver side of a key frame - a full chord starting and stopping, as playNotesTask diffs it
+static void BM_KeyFrameApply(benchmark::State& state) {
+    KeyStates keyStates;
+    uint8_t msg[8] = {0};
+    uint8_t sequence = 0;
+    for (auto _ : state) {
+        uint16_t notes = (sequence & 1) ? 0xFFF : 0;
+        packKeyFrame(msg, 4, 4, sequence++, notes, notes);
+        benchmark::DoNotOptimize(keyStates.apply(msg));
+    }
+}
+BENCHMARK(BM_KeyFrameApply);
+
+//Key debouncing - one 1 ms sample of all 28 inputs, with some of them bouncing
+static void BM_KeyDebounce(benchmark::State& state) {
+    KeyDebounce debounce;
+    uint32_t sample = 0xFFFFFFF;
+    for (auto _ : state) {
+        sample ^= 0x0000A05; // a few keys flipping every sample
+        benchmark::DoNotOptimize(debounce.update(sample));
+    }
+}
+BENCHMARK(BM_KeyDebounce);
+
+//Transmit ring - a key frame and a config message queued, then both taken for the mailboxes
+static void BM_CanTxRing(benchmark::State& state) {
+    CanTxRing ring;
+    CanTxFrame frame;
+    uint8_t msg[8] = {'K', 4};
+    for (auto _ : state) {
+        ring.push(0x004, msg);
+        ring.push(0x004, msg, true);
+        ring.pop(frame);
+        ring.pop(frame);
+        benchmark::DoNotOptimize(frame);
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_CanTxRing);
+
+//Cost of one profiling probe - a cycle count and a record, as PROFILE_TASKS adds to every task and ISR
+static uint32_t steppedCycles() {
+    static uint32_t cycles = 0;
+    return cycles += 37;
+}
+
+static void BM_ProfileRecord(benchmark::State& state) {
+    ProfileStats stats;
+    setCycleClock(steppedCycles);
+    for (auto _ : state) {
+        uint32_t start = cycleCount();
+        stats.record(cycleCount() - start);
+    }
+    setCycleClock(nullptr);
+    benchmark::DoNotOptimize(stats.getMean());
+}
+BENCHMARK(BM_ProfileRecord);
+
+//Cost of one trace event as TRACE_EVENTS adds it, with a batch read back every ring's worth
+static void BM_TraceWrite(benchmark::State& state) {
+    static TraceRing ring;
+    static TraceRecord batch[TRACE_BATCH];
+    ring.begin();
+    uint32_t written = 0;
+    for (auto _ : state) {
+        ring.write(EVENT_QUEUE_SEND, QUEUE_MSG_IN, 'P');
+        if (++written % TRACE_BATCH == 0) { ring.read(batch, TRACE_BATCH); }
+    }
+    benchmark::DoNotOptimize(ring.takeDropped());
+}
+BENCHMARK(BM_TraceWrite);
+
+BENCHMARK_MAIN();
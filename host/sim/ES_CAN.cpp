@@ -0,0 +1,70 @@
+#include <ES_CAN.h>
+#include <Simulator.h>
+#include <cstring>
+
+// Host ES_CAN - drives the simulated controller of the calling thread's board
+// Calls that busy-wait on the board (a message in the FIFO) block here instead
+
+static SimBoard& board() {
+    return *static_cast<SimBoard*>(hostBoard());
+}
+
+uint32_t CAN_Init(bool loopback) {
+    board().simulator().bus.init(board(), loopback);
+    return 0;
+}
+
+uint32_t CAN_Start() {
+    board().simulator().bus.begin(board());
+    return 0;
+}
+
+uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank, uint32_t fifo) {
+    board().simulator().bus.setFilter(board(), filterID, maskID, filterBank, fifo);
+    return 0;
+}
+
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8], bool urgent) {
+    CanFrame frame;
+    frame.id = ID;
+    std::memcpy(frame.data, data, 8);
+    return board().simulator().bus.transmit(board(), frame, urgent) ? 0 : 1;
+}
+
+uint32_t CAN_GetTxLevel() {
+    return board().simulator().bus.txLevel(board());
+}
+
+uint32_t CAN_GetTxHighWater() {
+    return board().simulator().bus.txHighWater(board());
+}
+
+uint32_t CAN_GetTxDropped() {
+    return board().simulator().bus.txDropped(board());
+}
+
+uint32_t CAN_CheckRXLevel(uint32_t fifo) {
+    return board().simulator().bus.rxLevel(board(), fifo);
+}
+
+uint32_t CAN_RX(uint32_t &ID, uint8_t data[8], uint32_t fifo) {
+    CanFrame frame;
+    if (!board().simulator().bus.receive(board(), fifo, frame)) { return 1; } // as HAL_ERROR
+    ID = frame.id;
+    std::memcpy(data, frame.data, 8);
+    return 0;
+}
+
+uint32_t CAN_RegisterRX_ISR(void(& callback)(), uint32_t fifo) {
+    board().simulator().bus.registerRX(board(), callback, fifo);
+    return 0;
+}
+
+uint32_t CAN_GetOverruns(uint32_t fifo) {
+    return board().simulator().bus.overruns(board(), fifo);
+}
+
+uint32_t CAN_RegisterTX_ISR(void(& callback)()) {
+    board().simulator().bus.registerTX(board(), callback);
+    return 0;
+}
@@ -0,0 +1,463 @@
+#include <Simulator.h>
+#include <constants.h>
+#include <algorithm>
+#include <cstring>
+
+using Clock = std::chrono::steady_clock;
+
+//Frame timing
+// Bits from SOF to the end of the CRC are stuffed - a complement bit after five equal bits
+static void pushBits(std::vector<bool>& bits, uint32_t value, int count) {
+    for (int i = count - 1; i >= 0; i--) { bits.push_back((value >> i) & 1); }
+}
+
+int canFrameBits(const CanFrame& frame) {
+    std::vector<bool> bits;
+    bits.push_back(0);              // SOF
+    pushBits(bits, frame.id, 11);
+    pushBits(bits, 0, 3);           // RTR, IDE, r0
+    pushBits(bits, 8, 4);           // DLC
+    for (int i = 0; i < 8; i++) { pushBits(bits, frame.data[i], 8); }
+
+    uint16_t crc = 0;
+    for (bool bit : bits) {
+        bool feedback = bit ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7fff;
+        if (feedback) { crc ^= 0x4599; }
+    }
+    pushBits(bits, crc, 15);
+
+    int stuffed = 0;
+    int run = 0;
+    bool last = !bits[0];
+    for (bool bit : bits) {
+        if (bit == last) { run++; }
+        else { run = 1; last = bit; }
+        if (run == 5) { // the stuff bit starts a run of the opposite value
+            stuffed++;
+            last = !bit;
+            run = 1;
+        }
+    }
+    return bits.size() + stuffed + 13; // CRC delimiter, ACK slot and delimiter, EOF, interframe space
+}
+
+//Board
+SimBoard::SimBoard(Simulator& simulator, int boardPosition, const BoardCode& boardCode) :
+    sim(simulator), position(boardPosition), code(boardCode) {}
+
+Simulator& SimBoard::simulator() {
+    return sim;
+}
+
+int SimBoard::row() const {
+    return pinValues[RA0_PIN] | (pinValues[RA1_PIN] << 1) | (pinValues[RA2_PIN] << 2);
+}
+
+void SimBoard::pinMode(int pin, int mode) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    HostBoard::pinMode(pin, mode);
+}
+
+void SimBoard::digitalWrite(int pin, int value) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    HostBoard::digitalWrite(pin, value);
+    if (pinValues[REN_PIN]) { // transparent while enabled
+        uint8_t bit = 1 << row();
+        if (pinValues[OUT_PIN]) { outLatch |= bit; }
+        else { outLatch &= ~bit; }
+    }
+}
+
+int SimBoard::digitalRead(int pin) {
+    int col;
+    if (pin == C0_PIN) { col = 0; }
+    else if (pin == C1_PIN) { col = 1; }
+    else if (pin == C2_PIN) { col = 2; }
+    else if (pin == C3_PIN) { col = 3; }
+    else {
+        std::lock_guard<std::mutex> lock(pinMutex);
+        return HostBoard::digitalRead(pin);
+    }
+
+    std::lock_guard<std::mutex> lock(pinMutex);
+    if (!pinValues[REN_PIN]) { return HIGH; }
+    int index = row() * 4 + col;
+    if (index == 23) {
+        SimBoard* west = sim.westOf(*this);
+        return !(west && west->outputBit(HKOE_BIT));
+    }
+    if (index == 27) {
+        SimBoard* east = sim.eastOf(*this);
+        return !(east && east->outputBit(HKOW_BIT));
+    }
+    return index < 28 ? keys[index] : HIGH;
+}
+
+int SimBoard::analogRead(int pin) {
+    if (pin == JOYX_PIN) { return joyX; }
+    if (pin == JOYY_PIN) { return joyY; }
+    return 0;
+}
+
+static void runTimer(SimBoard* board, void (*isr)(), uint32_t hz, const std::atomic<bool>* stopped) {
+    hostSetBoard(board);
+    Clock::time_point start = Clock::now();
+    uint64_t calls = 0;
+    while (!*stopped) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        uint64_t due = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count() * hz / 1000000;
+        for (; calls < due; calls++) { isr(); }
+    }
+}
+
+void SimBoard::startTimer(void (*isr)(), uint32_t hz) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    timers.emplace_back(runTimer, this, isr, hz, &timersStopped);
+}
+
+void SimBoard::stop() {
+    timersStopped = true;
+    std::vector<std::thread> stopping;
+    {
+        std::lock_guard<std::mutex> lock(pinMutex);
+        stopping.swap(timers);
+    }
+    for (std::thread& timer : stopping) { timer.join(); }
+    hostStopBoard(this);
+}
+
+bool SimBoard::outputBit(int bit) const {
+    return (outLatch >> bit) & 1;
+}
+
+void SimBoard::setKey(int index, bool pressed) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    keys[index] = !pressed;
+}
+
+void SimBoard::setJoystick(int x, int y) {
+    joyX = x;
+    joyY = y;
+}
+
+//Controller
+int CanController::nextMailbox() const {
+    int next = -1;
+    for (int i = 0; i < CAN_TX_MAILBOXES; i++) {
+        if (pending[i] && (next < 0 || mailboxes[i].id < mailboxes[next].id)) { next = i; }
+    }
+    return next;
+}
+
+void CanController::fillMailboxes() {
+    CanTxFrame frame;
+    for (int mailbox = 0; mailbox < CAN_TX_MAILBOXES; mailbox++) {
+        if (pending[mailbox] || !txRing.pop(frame)) { continue; }
+        mailboxes[mailbox].id = frame.id;
+        std::memcpy(mailboxes[mailbox].data, frame.data, 8);
+        pending[mailbox] = true;
+    }
+}
+
+int CanController::fifoFor(uint32_t id) const {
+    for (const CanFilter& filter : filters) {
+        if (filter.enabled && (id & filter.mask) == (filter.id & filter.mask)) { return filter.fifo; }
+    }
+    return -1;
+}
+
+//Bus
+CanBus::CanBus(Simulator& simulator) : sim(simulator) {
+    std::fill(std::begin(lastSender), std::end(lastSender), -1);
+}
+
+void CanBus::start() {
+    thread = std::thread(&CanBus::run, this);
+}
+
+void CanBus::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopRequested = true;
+        changed.notify_all();
+    }
+    thread.join();
+}
+
+void CanBus::init(SimBoard& board, bool loopback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    board.can.loopback = loopback;
+}
+
+void CanBus::setFilter(SimBoard& board, uint32_t id, uint32_t mask, uint32_t bank, uint32_t fifo) {
+    std::lock_guard<std::mutex> lock(mutex);
+    CanFilter& filter = board.can.filters[bank % CAN_FILTER_BANKS];
+    filter.enabled = true;
+    filter.id = id;
+    filter.mask = mask;
+    filter.fifo = fifo % CAN_RX_FIFOS;
+}
+
+void CanBus::begin(SimBoard& board) {
+    std::lock_guard<std::mutex> lock(mutex);
+    board.can.started = true;
+    changed.notify_all();
+}
+
+bool CanBus::transmit(SimBoard& board, const CanFrame& frame, bool urgent) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool queued = board.can.txRing.push(frame.id, frame.data, urgent);
+    board.can.fillMailboxes();
+    changed.notify_all();
+    return queued;
+}
+
+uint32_t CanBus::txLevel(SimBoard& board) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return board.can.txRing.getLevel();
+}
+
+uint32_t CanBus::txHighWater(SimBoard& board) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return board.can.txRing.getHighWater();
+}
+
+uint32_t CanBus::txDropped(SimBoard& board) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return board.can.txRing.getDropped();
+}
+
+uint32_t CanBus::rxLevel(SimBoard& board, uint32_t fifo) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return board.can.rxFifo[fifo % CAN_RX_FIFOS].size();
+}
+
+bool CanBus::receive(SimBoard& board, uint32_t fifo, CanFrame& frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::deque<CanFrame>& rxFifo = board.can.rxFifo[fifo % CAN_RX_FIFOS];
+    if (rxFifo.empty()) { return false; }
+    frame = rxFifo.front();
+    rxFifo.pop_front();
+    return true;
+}
+
+void CanBus::registerRX(SimBoard& board, void (*isr)(), uint32_t fifo) {
+    std::lock_guard<std::mutex> lock(mutex);
+    board.can.rxISR[fifo % CAN_RX_FIFOS] = isr;
+}
+
+uint32_t CanBus::overruns(SimBoard& board, uint32_t fifo) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return board.can.overruns[fifo % CAN_RX_FIFOS];
+}
+
+void CanBus::registerTX(SimBoard& board, void (*isr)()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    board.can.txISR = isr;
+}
+
+void CanBus::notify() {
+    std::lock_guard<std::mutex> lock(mutex);
+    changed.notify_all();
+}
+
+// Delivers frames whose last bit has passed to the FIFO chosen by the receiver's filters - the
+// receive FIFOs are not locked, so a full FIFO loses its newest message to the incoming one
+void CanBus::finishFrames(Clock::time_point now, std::vector<SimBoard*>& rx, std::vector<SimBoard*>& tx) {
+    for (auto it = inFlight.begin(); it != inFlight.end();) {
+        if (it->end > now) { it++; continue; }
+        SimBoard* sender = it->sender;
+        for (const std::vector<SimBoard*>& segment : sim.segments()) {
+            if (std::find(segment.begin(), segment.end(), sender) == segment.end()) { continue; }
+            for (SimBoard* board : segment) {
+                CanController& can = board->can;
+                bool self = board == sender;
+                if (!can.started || self != can.loopback) { continue; }
+                int fifo = can.fifoFor(it->frame.id);
+                if (fifo < 0) { continue; }
+                std::deque<CanFrame>& rxFifo = can.rxFifo[fifo];
+                if (rxFifo.size() == (size_t)CAN_RX_FIFO_DEPTH) {
+                    rxFifo.back() = it->frame;
+                    can.overruns[fifo]++;
+                } else {
+                    rxFifo.push_back(it->frame);
+                }
+                rx.push_back(board);
+            }
+        }
+        sender->can.pending[sender->can.sending] = false;
+        sender->can.sending = -1;
+        sender->can.fillMailboxes();
+        tx.push_back(sender);
+        it = inFlight.erase(it);
+    }
+}
+
+// Arbitration on each idle segment - the lowest ID wins, a frame needs another started
+// controller to acknowledge it unless the sender is in loopback
+void CanBus::startFrames(Clock::time_point now) {
+    for (const std::vector<SimBoard*>& segment : sim.segments()) {
+        bool busy = false;
+        int listeners = 0;
+        for (SimBoard* board : segment) {
+            if (board->can.sending >= 0) { busy = true; }
+            if (board->can.started && !board->can.loopback) { listeners++; }
+        }
+        if (busy) { continue; }
+
+        SimBoard* winner = nullptr;
+        uint32_t winnerId = 0;
+        int winnerMailbox = -1;
+        for (SimBoard* board : segment) {
+            CanController& can = board->can;
+            int mailbox = can.nextMailbox();
+            if (!can.started || mailbox < 0) { continue; }
+            if (!can.loopback && listeners < 2) { continue; }
+            uint32_t id = can.mailboxes[mailbox].id;
+            if (!winner || id < winnerId) {
+                winner = board;
+                winnerId = id;
+                winnerMailbox = mailbox;
+            } else if (id == winnerId) {
+                arbitrationTies++;
+            }
+        }
+        if (!winner) { continue; }
+
+        const CanFrame& frame = winner->can.mailboxes[winnerMailbox];
+        int& last = lastSender[frame.id & 0x7FF];
+        if (last >= 0 && last != winner->position) { sharedIds++; }
+        last = winner->position;
+        int frameBits = canFrameBits(frame);
+        uint32_t micros = frameBits * (1000000 / CAN_BIT_RATE);
+        winner->can.sending = winnerMailbox;
+        inFlight.push_back({winner, frame, now + std::chrono::microseconds(micros)});
+        frames++;
+        bits += frameBits;
+        busyMicros[segment.front()->position] += micros;
+    }
+}
+
+void CanBus::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopRequested) {
+        std::vector<SimBoard*> rx, tx;
+        Clock::time_point now = Clock::now();
+        finishFrames(now, rx, tx);
+        startFrames(now);
+
+        // Interrupts run on the receiving board, outside the bus lock as they call back into ES_CAN
+        if (!rx.empty() || !tx.empty()) {
+            lock.unlock();
+            for (SimBoard* board : rx) {
+                hostSetBoard(board);
+                for (int fifo = 0; fifo < CAN_RX_FIFOS; fifo++) { // FIFO 0 first, as its interrupt is numbered first
+                    while (true) { // level triggered - runs while the FIFO has messages
+                        uint32_t level = rxLevel(*board, fifo);
+                        void (*isr)() = board->can.rxISR[fifo];
+                        if (!level || !isr) { break; }
+                        isr();
+                        if (rxLevel(*board, fifo) >= level) { break; }
+                    }
+                }
+            }
+            for (SimBoard* board : tx) {
+                hostSetBoard(board);
+                if (board->can.txISR) { board->can.txISR(); }
+            }
+            hostSetBoard(nullptr);
+            lock.lock();
+            changed.notify_all(); // frames received
+            continue;
+        }
+
+        if (inFlight.empty()) {
+            changed.wait_for(lock, std::chrono::milliseconds(10));
+        } else {
+            Clock::time_point next = inFlight.front().end;
+            for (const InFlight& frame : inFlight) { next = std::min(next, frame.end); }
+            changed.wait_until(lock, next);
+        }
+    }
+}
+
+//Simulator
+Simulator::Simulator(int boardCount, const BoardCode* const* codes) : bus(*this) {
+    for (int i = 0; i < boardCount; i++) { boards.push_back(new SimBoard(*this, i, *codes[i])); }
+    bus.start();
+}
+
+Simulator::~Simulator() {
+    for (int i = 0; i < size(); i++) {
+        if (!setupThreads[i].joinable()) { continue; }
+        boards[i]->stop();
+        setupThreads[i].join();
+    }
+    bus.stop();
+    for (SimBoard* board : boards) { delete board; }
+}
+
+int Simulator::size() const {
+    return boards.size();
+}
+
+SimBoard& Simulator::board(int position) {
+    return *boards[position];
+}
+
+static void runBoard(SimBoard* board) {
+    hostSetBoard(board);
+    board->code.setup(); // returns once the board stops - setup starts the scheduler
+}
+
+void Simulator::powerOn(int position) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (powered[position]) { return; }
+        powered[position] = true;
+    }
+    setupThreads[position] = std::thread(runBoard, boards[position]);
+    bus.notify();
+}
+
+bool Simulator::isPowered(int position) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return powered[position];
+}
+
+void Simulator::setLink(int westPosition, bool connected) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        links[westPosition] = connected;
+    }
+    bus.notify();
+}
+
+bool Simulator::isLinked(int westPosition) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return links[westPosition];
+}
+
+SimBoard* Simulator::westOf(const SimBoard& board) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    int west = board.position - 1;
+    return (west >= 0 && links[west]) ? boards[west] : nullptr;
+}
+
+SimBoard* Simulator::eastOf(const SimBoard& board) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    int east = board.position + 1;
+    return (east < (int)boards.size() && links[board.position]) ? boards[east] : nullptr;
+}
+
+std::vector<std::vector<SimBoard*>> Simulator::segments() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::vector<SimBoard*>> result;
+    for (int i = 0; i < (int)boards.size(); i++) {
+        if (!powered[i]) { continue; }
+        if (i == 0 || !links[i - 1] || !powered[i - 1]) { result.push_back({}); }
+        result.back().push_back(boards[i]);
+    }
+    return result;
+}
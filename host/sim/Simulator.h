@@ -0,0 +1,214 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+// Multi-board simulator - up to SIM_MAX_BOARDS copies of the firmware in one process
+// Boards sit in a row (west to east). Neighbours can be linked or unlinked at any time, which
+// drives the handshake detect inputs and joins or splits the CAN bus between them.
+
+#include <HostBoard.h>
+#include <CanTxRing.h>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+const int SIM_MAX_BOARDS = 7;
+
+//CAN timing and controller limits (bxCAN)
+const uint32_t CAN_BIT_RATE = 125000;
+const int CAN_TX_MAILBOXES = 3;
+const int CAN_RX_FIFOS = 2;
+const int CAN_RX_FIFO_DEPTH = 3;
+const int CAN_FILTER_BANKS = 14;
+
+struct CanFrame {
+    uint32_t id;
+    uint8_t data[8];
+};
+
+//Bits on the wire for a standard 8 byte data frame, including stuff bits and interframe space
+int canFrameBits(const CanFrame& frame);
+
+//Hooks into one compiled copy of the firmware - see board.cpp
+struct BoardCode {
+    void (*setup)();
+    uint8_t (*octave)();
+    bool (*isReceiver)();
+    bool (*handshakeDone)();
+    bool (*isPlaying)(uint8_t octave, uint8_t note);
+    uint16_t (*keyNotes)(uint8_t octave); // held notes of an octave, from the key frames received
+    void (*printProfile)(); // over Serial, boards are built with PROFILE_TASKS
+    void (*printLatency)(); // over Serial, boards are built with TRACE_LATENCY
+    uint32_t (*canDropped)();  // received frames the RX ISRs found no queue space for
+    uint32_t (*scanJitter)();  // most microseconds a key scan started early or late, boards are built with PROFILE_TASKS
+    uint32_t (*state)();       // replicated state - state snapshot bytes 2-4 and 7 (generation, settings, receiver octave)
+};
+
+class Simulator;
+
+struct CanFilter {
+    bool enabled = false;
+    uint32_t id = 0;
+    uint32_t mask = 0;
+    uint8_t fifo = 0;
+};
+
+//Controller state of one board, guarded by the bus mutex
+struct CanController {
+    bool loopback = false;
+    bool started = false;
+    CanFilter filters[CAN_FILTER_BANKS];
+    void (*rxISR[CAN_RX_FIFOS])() = {nullptr, nullptr};
+    void (*txISR)() = nullptr;
+    CanTxRing txRing; // ES_CAN's transmit ring, refilled into the mailboxes as the interrupt would
+    CanFrame mailboxes[CAN_TX_MAILBOXES];
+    bool pending[CAN_TX_MAILBOXES] = {0};
+    int sending = -1; // mailbox on the bus
+    std::deque<CanFrame> rxFifo[CAN_RX_FIFOS];
+    uint32_t overruns[CAN_RX_FIFOS] = {0};
+
+    // Next mailbox to send - lowest ID, then lowest mailbox number (TransmitFifoPriority off), -1 if none
+    int nextMailbox() const;
+
+    // Moves waiting frames into the free mailboxes, lowest numbered first
+    void fillMailboxes();
+
+    // FIFO of the lowest numbered filter bank that accepts the ID, -1 if none does
+    int fifoFor(uint32_t id) const;
+};
+
+class SimBoard : public HostBoard {
+    private:
+        Simulator& sim;
+        std::mutex pinMutex;
+        std::atomic<uint8_t> outLatch{0}; // output mux bits, read by the neighbours
+        std::bitset<28> keys = 0xFFFFFFF; // active low
+        std::atomic<int> joyX{512};
+        std::atomic<int> joyY{512};
+        std::atomic<bool> timersStopped{false};
+        std::vector<std::thread> timers;
+
+        int row() const;
+
+    public:
+        const int position;
+        const BoardCode& code;
+        CanController can;
+
+        SimBoard(Simulator& simulator, int boardPosition, const BoardCode& boardCode);
+
+        Simulator& simulator();
+
+        void pinMode(int pin, int mode) override;
+
+        // REN high latches OUT_PIN into the output mux bit of the selected row, as on the board
+        void digitalWrite(int pin, int value) override;
+
+        // Columns read the key matrix of the selected row, with the neighbours' handshake outputs on
+        // the west (row 5) and east (row 6) detect inputs
+        int digitalRead(int pin) override;
+
+        int analogRead(int pin) override;
+
+        // Runs the ISR at hz on its own thread, in bursts that catch up every millisecond
+        void startTimer(void (*isr)(), uint32_t hz) override;
+
+        // Ends the timer threads and the tasks - setup()'s thread then returns from the scheduler
+        void stop();
+
+        bool outputBit(int bit) const;
+
+        void setKey(int index, bool pressed);
+
+        void setJoystick(int x, int y);
+};
+
+class CanBus {
+    private:
+        Simulator& sim;
+        std::mutex mutex;
+        std::condition_variable changed;
+        struct InFlight { SimBoard* sender; CanFrame frame; std::chrono::steady_clock::time_point end; };
+        std::vector<InFlight> inFlight;
+        int lastSender[2048];      // by ID, the position of the board that last sent it
+        bool stopRequested = false;
+        std::thread thread;
+
+        void run();
+        void startFrames(std::chrono::steady_clock::time_point now);
+        void finishFrames(std::chrono::steady_clock::time_point now, std::vector<SimBoard*>& rx, std::vector<SimBoard*>& tx);
+
+    public:
+        //Totals for reports
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> bits{0};
+        std::atomic<uint64_t> busyMicros[SIM_MAX_BOARDS] = {}; // by the westmost board of the segment carrying the frame
+        std::atomic<uint64_t> arbitrationTies{0};              // same ID from two boards at once - an error frame on real CAN
+        std::atomic<uint64_t> sharedIds{0};                    // frames with an ID another board sent last
+
+        CanBus(Simulator& simulator);
+
+        void start();
+
+        // Ends the bus thread, which calls into the boards - call once the boards have stopped
+        void stop();
+
+        // ES_CAN calls from the board of the calling thread
+        void init(SimBoard& board, bool loopback);
+        void setFilter(SimBoard& board, uint32_t id, uint32_t mask, uint32_t bank, uint32_t fifo);
+        void begin(SimBoard& board);
+        bool transmit(SimBoard& board, const CanFrame& frame, bool urgent); // false if the ring dropped a frame
+        uint32_t txLevel(SimBoard& board);
+        uint32_t txHighWater(SimBoard& board);
+        uint32_t txDropped(SimBoard& board);
+        uint32_t rxLevel(SimBoard& board, uint32_t fifo);
+        bool receive(SimBoard& board, uint32_t fifo, CanFrame& frame); // false if the FIFO is empty
+        void registerRX(SimBoard& board, void (*isr)(), uint32_t fifo);
+        uint32_t overruns(SimBoard& board, uint32_t fifo);
+        void registerTX(SimBoard& board, void (*isr)());
+
+        // Wakes the bus after a link change
+        void notify();
+};
+
+class Simulator {
+    private:
+        std::vector<SimBoard*> boards;
+        bool links[SIM_MAX_BOARDS] = {0}; // links[i] joins board i (west) to board i + 1 (east)
+        bool powered[SIM_MAX_BOARDS] = {0};
+        std::thread setupThreads[SIM_MAX_BOARDS];
+        mutable std::mutex mutex;
+
+    public:
+        CanBus bus;
+
+        Simulator(int boardCount, const BoardCode* const* codes);
+
+        // Stops and joins every board and bus thread, so none outlives the boards they use
+        ~Simulator();
+
+        int size() const;
+
+        SimBoard& board(int position);
+
+        // Starts a board's setup() on its own thread - boards cannot be restarted, their globals live on
+        void powerOn(int position);
+
+        bool isPowered(int position) const;
+
+        void setLink(int westPosition, bool connected);
+
+        bool isLinked(int westPosition) const;
+
+        SimBoard* westOf(const SimBoard& board) const;
+
+        SimBoard* eastOf(const SimBoard& board) const;
+
+        // Powered boards joined by links, west to east
+        std::vector<std::vector<SimBoard*>> segments() const;
+};
+
+#endif
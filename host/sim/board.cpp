@@ -0,0 +1,62 @@
+// One simulated board - the firmware's main.cpp compiled into its own namespace
+// Built once per board (SIM_BOARD=boardN, SIM_BOARD_CODE=boardCodeN) so every board has its own
+// globals and tasks. Headers are included first, so main.cpp's own includes are skipped by their
+// guards and only globals.h lands inside the namespace.
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <STM32FreeRTOS.h>
+#include <constants.h>
+#include <Knob.h>
+#include <State.h>
+#include <ES_CAN.h>
+#include <CanTxRing.h>
+#include <ES_IO.h>
+#include <waveforms.h>
+#include <Voices.h>
+#include <Filter.h>
+#include <AudioBuffer.h>
+#include <AudioOut.h>
+#include <Renderer.h>
+#include <Profiler.h>
+#include <LatencyTrace.h>
+#include <TraceRing.h>
+#include <KeyFrame.h>
+#include <KeyDebounce.h>
+#include <Simulator.h>
+#include <algorithm>
+#include <bitset>
+#include <string>
+#include <vector>
+
+namespace SIM_BOARD {
+#include "../../src/main.cpp"
+}
+
+extern const BoardCode SIM_BOARD_CODE = {
+    [] { SIM_BOARD::setup(); },
+    [] { return SIM_BOARD::sysState.getOctave(); },
+    [] { return SIM_BOARD::sysState.isReceiver(); },
+    [] {
+        TaskHandle_t handshake = SIM_BOARD::handshakeHandle;
+        if (!handshake) { return false; }
+        eTaskState state = eTaskGetState(handshake);
+        return state == eDeleted || state == eSuspended;
+    },
+    [](uint8_t octave, uint8_t note) { return SIM_BOARD::voicePool.isHeld(octave, note); },
+    [](uint8_t octave) { return SIM_BOARD::keyStates.getNotes(octave); },
+    [] {
+        for (int i = 0; i < PROFILE_SLOTS; i++) {
+            if (SIM_BOARD::profiles[i].getCount()) { SIM_BOARD::profiles[i].print(PROFILE_NAMES[i]); }
+        }
+        SIM_BOARD::scanJitter.print("scanJitter");
+    },
+    [] { SIM_BOARD::latencyTrace.print(); },
+    [] { return SIM_BOARD::canRxDropped[0] + SIM_BOARD::canRxDropped[1]; },
+    [] { return SIM_BOARD::scanJitter.getMax() / (uint32_t)(F_CPU / 1000000); },
+    [] {
+        uint8_t msg[8];
+        SIM_BOARD::sysState.packSnapshot(msg);
+        return (uint32_t)msg[2] | msg[3] << 8 | msg[4] << 16 | (uint32_t)msg[7] << 24;
+    }
+};
@@ -0,0 +1,477 @@
+// Multi-board simulator - runs the unmodified firmware of several boards against a simulated CAN bus
+//
+//   synth_sim [--boards N] [--presses M] [--soak K] [--storm R] [--seed S] [--join] [--chatter] [--bounce] [--shared] [--profile] [--trace] [--events FILE]
+//
+// Boards are linked in a row and powered on together, then:
+//   startup  - time until every board has finished its handshake, and the octaves it assigned, then
+//              time to first note - every board holds a key from power on, timed until the
+//              receiver plays all of them
+//   join     - with --join, the eastmost board is left off at startup. Board 0's waveform and volume
+//              knobs are turned, then the board is plugged in and powered on, timed until the octaves
+//              are contiguous again and it holds the same state (generation, settings and receiver
+//              octave) as board 0
+//   latency  - M key presses spread over the boards, timed from the key going down to the note
+//              starting on the receiver (min / median / p95 / max per board)
+//   bus load - frames, bits and the share of time each bus segment was busy during the presses, and
+//              the most frames each board's transmit ring held at once
+//   bounce   - with --bounce, every press and release bounces for about a millisecond before it
+//              settles. The receiver must start each note once and stop it once
+//   shared   - with --shared, board 0 turns its octave knob up to the eastmost board's octave, both
+//              hold a note in it through several key state refreshes, and the receiver must sound
+//              both notes until each is released. The two boards must keep to IDs of their own
+//              throughout. Board 0's knob is then turned back
+//   chatter  - with --chatter, every board turns its waveform and volume knobs during the presses,
+//              so key frames compete with a config message from each board every few milliseconds.
+//              Then boards 0 and N-1 turn their volume knobs opposite ways at once, and every board
+//              must settle on the same state
+//   storm    - R rounds after the presses in which every board presses a random chord in the same
+//              instant, then lets go; the receiver's key states must match the chords, then no note
+//              may be left held. Receive FIFO overruns and frames dropped for a full queue are
+//              reported with the bus load
+//   soak     - K random unplug / replug cycles, after each the octaves must still be contiguous with
+//              a single receiver. Then the most each board's key scan started early or late (from
+//              the start of the run), which must stay under SCAN_STALL_LIMIT_US
+//   profile  - with --profile, each board's task and ISR cycle statistics (mock clock at F_CPU)
+//   trace    - with --trace, the firmware's own latency trace of the presses, stage by stage
+//   events   - with --events, board 0's Serial stream (its TRACE_EVENTS batches) is written to FILE
+//              for host/tools/trace_decode
+// The exit code is non-zero if a check fails. Boards are host threads without preemption, so times
+// include host scheduling noise - compare runs on the same machine rather than with the board.
+
+#include <Simulator.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern const BoardCode boardCode0, boardCode1, boardCode2, boardCode3, boardCode4, boardCode5, boardCode6;
+static const BoardCode* const boardCodes[SIM_MAX_BOARDS] = {
+    &boardCode0, &boardCode1, &boardCode2, &boardCode3, &boardCode4, &boardCode5, &boardCode6
+};
+
+using Clock = std::chrono::steady_clock;
+
+//Most a key scan may start early or late during the soak. Boards are host threads without preemption,
+//so this only catches a scan held up by a blocking call, such as the 980 ms hot-plug wait - host
+//scheduling noise alone reaches 20 ms on one core. The board's own limit is SCAN_JITTER_LIMIT_US
+const uint32_t SCAN_STALL_LIMIT_US = 50000;
+
+//Contact bounce - a key changes BOUNCE_EDGES times, BOUNCE_US apart, before it settles
+const int BOUNCE_EDGES = 4;
+const int BOUNCE_US = 300;
+
+//Key matrix inputs of the knobs' A signals, B is the next input
+const int KNOB_WAVEFORM_A = 16;
+const int KNOB_VOLUME_A = 12;
+const int KNOB_OCTAVE_A = 14;
+
+static double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+template<class Predicate>
+static bool waitUntil(Predicate ready, uint32_t timeoutMs, uint32_t pollMicros = 1000) {
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!ready()) {
+        if (Clock::now() >= deadline) { return false; }
+        std::this_thread::sleep_for(std::chrono::microseconds(pollMicros));
+    }
+    return true;
+}
+
+static int receiverOf(Simulator& sim, int count) {
+    int receiver = -1;
+    for (int i = 0; i < count; i++) {
+        if (!sim.board(i).code.isReceiver()) { continue; }
+        if (receiver >= 0) { return -2; } // more than one
+        receiver = i;
+    }
+    return receiver;
+}
+
+static int receiverOf(Simulator& sim) {
+    return receiverOf(sim, sim.size());
+}
+
+// Octaves of the westmost count boards must rise by one from west to east, with exactly one receiver
+static bool consistent(Simulator& sim, std::string& report, int count) {
+    bool ok = true;
+    report = "octaves";
+    for (int i = 0; i < count; i++) {
+        uint8_t octave = sim.board(i).code.octave();
+        report += " " + std::to_string(octave);
+        if (i > 0 && octave != sim.board(i - 1).code.octave() + 1) { ok = false; }
+    }
+    int receiver = receiverOf(sim, count);
+    report += receiver >= 0 ? ", receiver " + std::to_string(receiver) : (receiver == -1 ? ", no receiver" : ", several receivers");
+    return ok && receiver >= 0;
+}
+
+static bool consistent(Simulator& sim, std::string& report) {
+    return consistent(sim, report, sim.size());
+}
+
+// Turns a knob up by whole quadrature cycles (A low, B low, A high, B high), two steps each, with
+// a scan to see each edge as a hand would. Negative cycles turn it down, with B leading A
+static void turnKnob(SimBoard& board, int inputA, int cycles) {
+    bool down = cycles < 0;
+    for (int i = 0; i < std::abs(cycles) * 4; i++) {
+        board.setKey(inputA + (i % 2 ^ down), i % 4 < 2); // pressed is low
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    }
+}
+
+static void setKeyBouncing(SimBoard& board, int index, bool pressed) {
+    for (int i = 0; i < BOUNCE_EDGES; i++) {
+        board.setKey(index, pressed == (i % 2 == 0));
+        std::this_thread::sleep_for(std::chrono::microseconds(BOUNCE_US));
+    }
+    board.setKey(index, pressed);
+}
+
+static double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    int boardCount = 3;
+    int presses = 60;
+    int soakCycles = 0;
+    int stormRounds = 0;
+    uint32_t seed = 1;
+    bool profile = false;
+    bool trace = false;
+    bool chatter = false;
+    bool join = false;
+    bool bounce = false;
+    bool shared = false;
+    const char* eventsPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (hasValue && !std::strcmp(argv[i], "--boards")) { boardCount = std::atoi(argv[++i]); }
+        else if (hasValue && !std::strcmp(argv[i], "--presses")) { presses = std::atoi(argv[++i]); }
+        else if (hasValue && !std::strcmp(argv[i], "--soak")) { soakCycles = std::atoi(argv[++i]); }
+        else if (hasValue && !std::strcmp(argv[i], "--storm")) { stormRounds = std::atoi(argv[++i]); }
+        else if (hasValue && !std::strcmp(argv[i], "--seed")) { seed = std::atoi(argv[++i]); }
+        else if (hasValue && !std::strcmp(argv[i], "--events")) { eventsPath = argv[++i]; }
+        else if (!std::strcmp(argv[i], "--join")) { join = true; }
+        else if (!std::strcmp(argv[i], "--chatter")) { chatter = true; }
+        else if (!std::strcmp(argv[i], "--bounce")) { bounce = true; }
+        else if (!std::strcmp(argv[i], "--shared")) { shared = true; }
+        else if (!std::strcmp(argv[i], "--profile")) { profile = true; }
+        else if (!std::strcmp(argv[i], "--trace")) { trace = true; }
+        else {
+            std::cerr << "usage: synth_sim [--boards N] [--presses M] [--soak K] [--storm R] [--seed S] [--join] [--chatter] [--bounce] [--shared] [--profile] [--trace] [--events FILE]\n";
+            return 2;
+        }
+    }
+    if (boardCount < 1 || boardCount > SIM_MAX_BOARDS) {
+        std::cerr << "--boards must be 1 to " << SIM_MAX_BOARDS << "\n";
+        return 2;
+    }
+    if (shared && boardCount != 3) {
+        std::cerr << "--shared needs 3 boards\n";
+        return 2;
+    }
+    if (join && boardCount < 2) {
+        std::cerr << "--join needs at least 2 boards\n";
+        return 2;
+    }
+
+    Serial.enabled = false; // the boards share stdout
+    std::mt19937 random(seed);
+    Simulator sim(boardCount, boardCodes);
+    bool failed = false;
+    if (eventsPath && !(sim.board(0).serial = std::fopen(eventsPath, "wb"))) {
+        std::cerr << "cannot write " << eventsPath << "\n";
+        return 2;
+    }
+
+    //Startup
+    int active = join ? boardCount - 1 : boardCount;
+    for (int i = 0; i + 1 < active; i++) { sim.setLink(i, true); }
+    for (int i = 0; i < active; i++) { sim.board(i).setKey(0, true); } // held from power on
+    Clock::time_point powerOn = Clock::now();
+    for (int i = 0; i < active; i++) { sim.powerOn(i); }
+    auto handshakesDone = [&] {
+        for (int i = 0; i < active; i++) { if (!sim.board(i).code.handshakeDone()) { return false; } }
+        return true;
+    };
+    bool started = waitUntil(handshakesDone, 10000);
+    double handshakeMs = msSince(powerOn);
+    std::string report;
+    bool ok = started && consistent(sim, report, active);
+    bool playable = ok && waitUntil([&] {
+        int receiver = receiverOf(sim, active);
+        if (receiver < 0) { return false; }
+        for (int i = 0; i < active; i++) {
+            if (!sim.board(receiver).code.isPlaying(sim.board(i).code.octave(), 0)) { return false; }
+        }
+        return true;
+    }, 10000, 100);
+    double firstNoteMs = msSince(powerOn);
+    for (int i = 0; i < active; i++) { sim.board(i).setKey(0, false); }
+    std::printf("startup   %s in %.0f ms, %s\n", started ? "handshake done" : "handshake timed out", handshakeMs, report.c_str());
+    if (playable) { std::printf("          first note from every board after %.0f ms\n", firstNoteMs); }
+    else if (ok) { std::printf("          FAILED: no first note from every board\n"); }
+    if (!playable) { return 1; }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500)); // connection messages settle
+
+    //Join
+    if (join) {
+        int late = boardCount - 1;
+        const BoardCode& first = sim.board(0).code;
+        turnKnob(sim.board(0), KNOB_WAVEFORM_A, 1);
+        turnKnob(sim.board(0), KNOB_VOLUME_A, 2);
+        waitUntil([&] { // the other boards have the changes
+            for (int i = 1; i < late; i++) { if (sim.board(i).code.state() != first.state()) { return false; } }
+            return true;
+        }, 1000);
+        Clock::time_point plugged = Clock::now();
+        sim.setLink(late - 1, true);
+        sim.powerOn(late);
+        bool placed = waitUntil([&] { return sim.board(late).code.handshakeDone() && consistent(sim, report); }, 10000);
+        double placedMs = msSince(plugged);
+        bool synced = placed && waitUntil([&] { return sim.board(late).code.state() == first.state(); }, 5000);
+        double syncedMs = msSince(plugged);
+        std::printf("join      board %d %s after %.0f ms, %s\n", late, placed ? "placed" : "not placed", placedMs, report.c_str());
+        if (synced) { std::printf("          same state as board 0 after %.0f ms\n", syncedMs); }
+        else { std::printf("          FAILED: state %06x, board 0 %06x\n", sim.board(late).code.state(), first.state()); }
+        if (!synced) { return 1; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    }
+
+    //Latency
+    int receiver = receiverOf(sim);
+    std::vector<std::vector<double>> latencies(boardCount);
+    uint64_t frames = sim.bus.frames, bits = sim.bus.bits;
+    uint64_t busy[SIM_MAX_BOARDS];
+    for (int i = 0; i < SIM_MAX_BOARDS; i++) { busy[i] = sim.bus.busyMicros[i]; }
+    Clock::time_point windowStart = Clock::now();
+    std::atomic<bool> pressing{true};
+    std::thread knobs([&] { // knob A inputs flip every scan, each flip moves the knob one step back or forth
+        for (bool a = true; chatter && pressing; a = !a) {
+            for (int i = 0; i < boardCount; i++) {
+                sim.board(i).setKey(KNOB_WAVEFORM_A, a);
+                sim.board(i).setKey(KNOB_VOLUME_A, a);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    });
+    int lost = 0;
+    int glitches = 0;
+    for (int press = 0; press < presses; press++) {
+        int position = press % boardCount;
+        SimBoard& board = sim.board(position);
+        uint8_t octave = board.code.octave();
+        uint8_t note = random() % 12;
+        const BoardCode& heard = sim.board(receiver).code;
+
+        Clock::time_point down = Clock::now();
+        if (bounce) { setKeyBouncing(board, note, true); }
+        else { board.setKey(note, true); }
+        bool played = waitUntil([&] { return heard.isPlaying(octave, note); }, 1000, 100);
+        if (played) {
+            latencies[position].push_back(msSince(down));
+        } else {
+            lost++;
+        }
+        if (bounce && played && waitUntil([&] { return !heard.isPlaying(octave, note); }, 20, 100)) { glitches++; } // stopped while held
+        if (bounce) { setKeyBouncing(board, note, false); }
+        else { board.setKey(note, false); }
+        waitUntil([&] { return !heard.isPlaying(octave, note); }, 1000, 100);
+        if (bounce && waitUntil([&] { return heard.isPlaying(octave, note); }, 20, 100)) { glitches++; } // started again after the release
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 + random() % 40)); // spread over the scan period
+    }
+
+    //Storm
+    int stuck = 0;
+    for (int round = 0; round < stormRounds; round++) {
+        std::vector<uint16_t> chords(boardCount);
+        for (int i = 0; i < boardCount; i++) { chords[i] = random() & 0xFFF; }
+        bool roundFailed = false;
+        for (bool down : {true, false}) {
+            for (int note = 0; note < 12; note++) { // all boards within the same scan
+                for (int i = 0; i < boardCount; i++) {
+                    if (chords[i] >> note & 1) { sim.board(i).setKey(note, down); }
+                }
+            }
+            const BoardCode& heard = sim.board(receiver).code;
+            auto settled = [&] {
+                for (int i = 0; i < boardCount; i++) { // voices can be stolen, so held notes are checked on release only
+                    uint8_t octave = sim.board(i).code.octave();
+                    if (heard.keyNotes(octave) != (down ? chords[i] : 0)) { return false; }
+                    for (int note = 0; note < 12 && !down; note++) {
+                        if (heard.isPlaying(octave, note)) { return false; }
+                    }
+                }
+                return true;
+            };
+            if (!waitUntil(settled, 250)) { // before the 500 ms key frame refresh could hide a lost frame
+                std::printf("storm     round %d: receiver notes differ from the keys after the %s\n", round, down ? "presses" : "releases");
+                roundFailed = true;
+            }
+        }
+        if (roundFailed) { stuck++; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 + random() % 40));
+    }
+    double window = msSince(windowStart);
+    pressing = false;
+    knobs.join();
+
+    std::printf("latency   key down to note on at the receiver (board %d), ms\n", receiver);
+    std::printf("          board  presses     min  median     p95     max\n");
+    for (int i = 0; i < boardCount; i++) {
+        std::vector<double>& times = latencies[i];
+        if (times.empty()) { continue; }
+        std::printf("          %5d  %7zu  %6.2f  %6.2f  %6.2f  %6.2f\n", i, times.size(),
+                    percentile(times, 0), percentile(times, 0.5), percentile(times, 0.95), percentile(times, 1));
+    }
+    if (lost) {
+        std::printf("          %d presses never reached the receiver\n", lost);
+        failed = true;
+    }
+
+    if (bounce) {
+        std::printf("bounce    %d of %d bouncing presses started or stopped a note more than once\n", glitches, presses);
+        if (glitches) { failed = true; }
+    }
+
+    if (stormRounds) {
+        std::printf("storm     %d of %d chord rounds left the receiver out of step\n", stuck, stormRounds);
+        if (stuck) { failed = true; }
+    }
+
+
+    //Bus load
+    frames = sim.bus.frames - frames;
+    bits = sim.bus.bits - bits;
+    std::printf("bus load  %llu frames, %llu bits (%.1f bits per frame) in %.0f ms at %u bit/s\n",
+                (unsigned long long)frames, (unsigned long long)bits, frames ? (double)bits / frames : 0.0, window, CAN_BIT_RATE);
+    for (int i = 0; i < boardCount; i++) {
+        uint64_t segmentBusy = sim.bus.busyMicros[i] - busy[i];
+        if (segmentBusy) { std::printf("          segment from board %d busy %.2f%%\n", i, segmentBusy / (window * 10)); }
+    }
+    if (sim.bus.arbitrationTies) {
+        std::printf("          %llu arbitration ties on equal IDs\n", (unsigned long long)sim.bus.arbitrationTies.load());
+    }
+    for (int i = 0; i < boardCount; i++) {
+        SimBoard& board = sim.board(i);
+        uint32_t overruns = board.can.overruns[0] + board.can.overruns[1];
+        if (overruns) { std::printf("          board %d lost %u frames to receive FIFO overruns\n", i, overruns); }
+        if (board.code.canDropped()) { std::printf("          board %d dropped %u received frames for a full queue\n", i, board.code.canDropped()); }
+        if (sim.bus.txDropped(board)) { std::printf("          board %d dropped %u frames for a full transmit ring\n", i, sim.bus.txDropped(board)); }
+    }
+    std::printf("          transmit ring high-water marks");
+    for (int i = 0; i < boardCount; i++) { std::printf(" %u", sim.bus.txHighWater(sim.board(i))); }
+    std::printf("\n");
+
+    //Concurrent settings
+    if (chatter && boardCount > 1) { // the end boards turn the volume opposite ways in the same instant
+        const BoardCode& first = sim.board(0).code;
+        auto same = [&] {
+            for (int i = 1; i < boardCount; i++) { if (sim.board(i).code.state() != first.state()) { return false; } }
+            return true;
+        };
+        turnKnob(sim.board(0), KNOB_VOLUME_A, 4); // off the bottom of the range
+        waitUntil(same, 1000);
+        SimBoard& east = sim.board(boardCount - 1);
+        east.setKey(KNOB_VOLUME_A + 1, true); // B leads, so east's A edges turn it down in step with board 0's
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        for (int i = 0; i < 8; i++) { // two cycles each
+            sim.board(0).setKey(KNOB_VOLUME_A + i % 2, i % 4 < 2);
+            east.setKey(KNOB_VOLUME_A + i % 2, i % 2 ? i % 4 >= 2 : i % 4 < 2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        }
+        east.setKey(KNOB_VOLUME_A + 1, false);
+        bool agreed = waitUntil(same, 1000);
+        std::printf("settings  after boards 0 and %d turned the volume opposite ways together: %s\n", boardCount - 1,
+                    agreed ? "same state on every board" : "FAILED, boards disagree");
+        for (int i = 0; !agreed && i < boardCount; i++) { std::printf("          board %d state %06x\n", i, sim.board(i).code.state()); }
+        if (!agreed) { failed = true; }
+    }
+
+    //Shared octave
+    if (shared) {
+        SimBoard& west = sim.board(0);
+        SimBoard& east = sim.board(2);
+        const BoardCode& heard = sim.board(receiverOf(sim)).code;
+        uint64_t sharedIds = sim.bus.sharedIds;
+        turnKnob(west, KNOB_OCTAVE_A, 1); // two octaves up, onto the eastmost board's
+        uint8_t octave = east.code.octave();
+        bool moved = waitUntil([&] { return west.code.octave() == octave; }, 500);
+        auto playing = [&](bool first, bool second) {
+            return heard.isPlaying(octave, 1) == first && heard.isPlaying(octave, 2) == second;
+        };
+        west.setKey(1, true);
+        bool held = moved && waitUntil([&] { return playing(true, false); }, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1200)); // the idle east board refreshes its empty state twice
+        held = held && playing(true, false);
+        east.setKey(2, true);
+        bool both = held && waitUntil([&] { return playing(true, true); }, 500);
+        west.setKey(1, false);
+        bool eastOnly = both && waitUntil([&] { return playing(false, true); }, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+        eastOnly = eastOnly && playing(false, true);
+        east.setKey(2, false);
+        bool released = eastOnly && waitUntil([&] { return playing(false, false); }, 500);
+        bool ownIds = sim.bus.sharedIds == sharedIds; // one octave, but each board keeps its own IDs
+        turnKnob(west, KNOB_OCTAVE_A, -1);
+        std::printf("shared    boards 0 and 2 on octave %d: %s\n", octave,
+                    !moved ? "FAILED, board 0 did not change octave" :
+                    !held ? "FAILED, board 2's refresh released board 0's note" :
+                    !both ? "FAILED, both notes did not sound" :
+                    !eastOnly ? "FAILED, board 2's note did not stay after board 0's release" :
+                    !released ? "FAILED, a note stayed on" :
+                    !ownIds ? "FAILED, both boards sent frames with the same ID" : "both notes sounded and released");
+        if (!released || !ownIds) { failed = true; }
+        waitUntil([&] { return west.code.octave() + 1 == sim.board(1).code.octave(); }, 500);
+    }
+
+    //Soak
+    int broken = 0;
+    for (int cycle = 0; cycle < soakCycles && boardCount > 1; cycle++) {
+        int link = random() % (boardCount - 1);
+        sim.setLink(link, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200 + random() % 800));
+        sim.setLink(link, true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2500)); // new connections wait 1 s before sending
+        if (!consistent(sim, report)) {
+            broken++;
+            std::printf("soak      cycle %d, link %d-%d: %s\n", cycle, link, link + 1, report.c_str());
+        }
+    }
+    if (soakCycles) {
+        std::printf("soak      %d of %d replug cycles left the boards inconsistent\n", broken, soakCycles);
+        if (broken) { failed = true; }
+        std::printf("          scan jitter, ms");
+        bool stalled = false;
+        for (int i = 0; i < boardCount; i++) {
+            uint32_t jitter = sim.board(i).code.scanJitter();
+            std::printf(" %.2f", jitter / 1000.0);
+            if (jitter > SCAN_STALL_LIMIT_US) { stalled = true; }
+        }
+        std::printf(stalled ? " - FAILED, a scan was held up\n" : "\n");
+        if (stalled) { failed = true; }
+    }
+
+    //Profile and trace
+    std::fflush(stdout);
+    Serial.enabled = profile || trace; // boards keep running until sim is destroyed, so their own prints may interleave
+    for (int i = 0; i < boardCount && profile; i++) {
+        std::printf("profile   board %d\n", i);
+        sim.board(i).code.printProfile();
+    }
+    for (int i = 0; i < boardCount && trace; i++) {
+        std::printf("trace     board %d\n", i);
+        sim.board(i).code.printLatency();
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Host stand-in for the Arduino core - just enough for the synth libraries to build and run on Linux
+// Pins read back what was last written (inputs idle high), analogRead returns the joystick centre
+// and time comes from the host's steady clock
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+#define PI 3.1415926535897932384626433832795
+#define F_CPU 80000000L
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+enum HostPin { D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13,
+               A0, A1, A2, A3, A4, A5, A6, A7, LED_BUILTIN, HOST_PINS };
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+void digitalToggle(int pin);
+void analogWrite(int pin, int value);
+void analogWriteResolution(int bits);
+int analogRead(int pin);
+
+//GPIO ports - stand-ins for the bit set/reset (BSRR) and input data (IDR) registers, which pass each
+//bit to the pins of the calling thread's board, with the Nucleo-L432KC's pin map
+class HostPortSetReset {
+    public:
+        const int port;
+        void operator=(uint32_t value); // bits 0-15 set pins, bits 16-31 reset them, set wins
+};
+
+class HostPortInput {
+    public:
+        const int port;
+        operator uint32_t() const;
+};
+
+struct GPIO_TypeDef {
+    HostPortSetReset BSRR;
+    HostPortInput IDR;
+};
+
+extern GPIO_TypeDef hostPorts[3];
+#define GPIOA (&hostPorts[0])
+#define GPIOB (&hostPorts[1])
+#define GPIOC (&hostPorts[2])
+
+GPIO_TypeDef* digitalPinToPort(int pin);
+uint32_t digitalPinToBitMask(int pin);
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+//Where Serial output of the calling thread goes - its board's own stream if it has one, otherwise
+//stdout unless Serial is disabled (nullptr)
+FILE* hostSerialOutput();
+
+class HostSerial {
+    public:
+        bool enabled = true; // tools running several boards turn the boards' output off
+
+        void begin(unsigned long) {}
+        void print(const char* text) { if (FILE* out = hostSerialOutput()) { std::fputs(text, out); } }
+        void print(const std::string& text) { print(text.c_str()); }
+        void print(char c) { if (FILE* out = hostSerialOutput()) { std::fputc(c, out); } }
+        void print(long value) { if (FILE* out = hostSerialOutput()) { std::fprintf(out, "%ld", value); } }
+        void print(unsigned long value) { if (FILE* out = hostSerialOutput()) { std::fprintf(out, "%lu", value); } }
+        void print(int value) { print((long)value); }
+        void print(unsigned int value) { print((unsigned long)value); }
+        void print(double value) { if (FILE* out = hostSerialOutput()) { std::fprintf(out, "%.2f", value); } }
+        template<class T> void println(T value) { print(value); println(); }
+        void println() { print('\n'); }
+        size_t write(const uint8_t* data, size_t length) { FILE* out = hostSerialOutput(); return out ? std::fwrite(data, 1, length, out) : length; }
+        int availableForWrite() { return 64; }
+};
+
+extern HostSerial Serial;
+
+typedef struct { int instance; } TIM_TypeDef;
+extern TIM_TypeDef hostTimers[2];
+#define TIM1 (&hostTimers[0])
+#define TIM2 (&hostTimers[1])
+
+enum TimerFormat { TICK_FORMAT, MICROSEC_FORMAT, HERTZ_FORMAT };
+
+//Periodic interrupt from the board of the calling thread - only the simulator's boards run it,
+//elsewhere tools call sampleISR themselves
+void hostStartTimer(void (*isr)(), uint32_t hz);
+
+class HardwareTimer {
+    private:
+        uint32_t hz = 0;
+        void (*isr)() = nullptr;
+
+    public:
+        HardwareTimer(TIM_TypeDef*) {}
+        void setOverflow(uint32_t overflow, TimerFormat format) { if (format == HERTZ_FORMAT) { hz = overflow; } }
+        void attachInterrupt(void (*callback)()) { isr = callback; }
+        void resume() { if (isr && hz) { hostStartTimer(isr, hz); } }
+        void pause() {}
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+// One simulated board - owns the pins and the FreeRTOS tasks of the code running on it
+// Every host thread belongs to a board: pin accesses and task calls go to the board of the
+// calling thread, and tasks inherit the board of the thread that created them.
+// Tools with a single board use the default board, which just remembers what was written.
+
+#include <Arduino.h>
+#include <STM32FreeRTOS.h>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+struct HostTask;
+
+class HostBoard {
+    protected:
+        int pinValues[HOST_PINS] = {0};
+        int pinModes[HOST_PINS] = {0};
+
+    public:
+        std::mutex taskMutex;
+        std::vector<HostTask*> tasks;
+        bool schedulerStarted = false;
+        bool stopRequested = false;          // set by hostStopBoard
+        std::condition_variable stopped;     // wakes vTaskStartScheduler to end the tasks
+        FILE* serial = nullptr; // own Serial output, e.g. to capture one board's trace stream
+
+        virtual ~HostBoard() {}
+
+        virtual void pinMode(int pin, int mode);
+
+        virtual void digitalWrite(int pin, int value);
+
+        // Inputs are pulled up (nothing pressed), outputs read back what was written
+        virtual int digitalRead(int pin);
+
+        // Joystick centred
+        virtual int analogRead(int pin);
+
+        // Timers do not run by default
+        virtual void startTimer(void (*isr)(), uint32_t hz);
+};
+
+//Board of the calling thread
+HostBoard* hostBoard();
+
+//Moves the calling thread to a board - threads it creates from then on run on the same board
+void hostSetBoard(HostBoard* board);
+
+//Stops every task of a board at its next FreeRTOS call, e.g. when the board is powered off
+//The board's vTaskStartScheduler returns once they have all ended
+void hostStopBoard(HostBoard* board);
+
+#endif
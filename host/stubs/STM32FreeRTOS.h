@@ -0,0 +1,67 @@
+#ifndef HOST_STM32FREERTOS_H
+#define HOST_STM32FREERTOS_H
+
+// Host stand-in for the FreeRTOS API used by the synth
+// Semaphores, mutexes and queues block like the real ones (built on std::mutex), so library code
+// keeps its locking when run from host threads. Ticks are milliseconds of host time.
+// Tasks are host threads, started by vTaskStartScheduler in priority order. There is no preemption:
+// suspending or deleting another task takes effect at its next FreeRTOS call or delay.
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+struct HostSemaphore;
+struct HostQueue;
+typedef HostSemaphore* SemaphoreHandle_t;
+typedef HostQueue* QueueHandle_t;
+typedef QueueHandle_t xQueueHandle;
+typedef void* TaskHandle_t;
+
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (ms)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errQUEUE_FULL 0
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted, eInvalid } eTaskState;
+typedef void (*TaskFunction_t)(void*);
+
+//Semaphores and mutexes
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higherPriorityTaskWoken);
+
+//Queues of fixed size items
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticksToWait);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+//Tasks
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stackDepth, void* parameters, UBaseType_t priority, TaskHandle_t* createdTask);
+void vTaskStartScheduler();
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+void vTaskDelete(TaskHandle_t task);
+eTaskState eTaskGetState(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+//Time
+TickType_t xTaskGetTickCount();
+TickType_t xTaskGetTickCountFromISR();
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t* previousWakeTime, TickType_t period);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef HOST_U8G2LIB_H
+#define HOST_U8G2LIB_H
+
+// Host stand-in for the display driver - draws nothing
+
+#include <cstdint>
+#include <string>
+
+#define U8G2_R0 0
+
+static const uint8_t u8g2_font_ncenB08_tr[1] = {0};
+static const uint8_t u8g2_font_5x7_mf[1] = {0};
+
+class U8G2_SSD1305_128X32_NONAME_F_HW_I2C {
+    public:
+        U8G2_SSD1305_128X32_NONAME_F_HW_I2C(int) {}
+        void begin() {}
+        void clearBuffer() {}
+        void sendBuffer() {}
+        void setFont(const uint8_t*) {}
+        void setCursor(int, int) {}
+        void drawStr(int, int, const char*) {}
+        template<class T> void print(T) {}
+};
+
+#endif
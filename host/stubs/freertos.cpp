@@ -0,0 +1,346 @@
+#include <HostBoard.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+
+//Tasks
+struct HostTask {
+    TaskFunction_t code;
+    void* parameters;
+    std::string name;
+    UBaseType_t priority;
+    HostBoard* board;
+    std::mutex mutex;
+    std::condition_variable resumed;
+    eTaskState state = eReady;
+    bool suspendRequested = false;
+    bool deleteRequested = false;
+    bool started = false;   // has reached its first FreeRTOS call
+    std::thread thread;     // joined by the scheduler once the board stops
+};
+
+// Thrown at a FreeRTOS call of a deleted task, caught where its thread started
+struct HostTaskDeleted {};
+
+static thread_local HostTask* currentTask = nullptr;
+static std::condition_variable taskStarted;
+
+// Called at every FreeRTOS call - applies suspend and delete requests from other tasks
+static void checkpoint() {
+    HostTask* task = currentTask;
+    if (!task) { return; }
+    std::unique_lock<std::mutex> lock(task->mutex);
+    if (!task->started) {
+        task->started = true;
+        taskStarted.notify_all();
+    }
+    while (task->suspendRequested && !task->deleteRequested) {
+        task->state = eSuspended;
+        task->resumed.wait(lock);
+    }
+    if (task->deleteRequested) {
+        task->state = eDeleted;
+        throw HostTaskDeleted();
+    }
+    task->state = eReady;
+}
+
+// Marks the calling task blocked while it waits, so eTaskGetState sees what FreeRTOS would
+struct BlockedScope {
+    BlockedScope() {
+        checkpoint();
+        if (currentTask) { std::lock_guard<std::mutex> lock(currentTask->mutex); currentTask->state = eBlocked; }
+    }
+    ~BlockedScope() {
+        if (currentTask) { std::lock_guard<std::mutex> lock(currentTask->mutex); currentTask->state = eReady; }
+    }
+};
+
+// Waits on a condition for up to ticksToWait milliseconds, forever for portMAX_DELAY
+// Waits are sliced so a task deleted while blocked still ends
+template<class Predicate>
+static bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticksToWait, Predicate ready) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ticksToWait);
+    while (!ready()) {
+        if (currentTask && __atomic_load_n(&currentTask->deleteRequested, __ATOMIC_RELAXED)) {
+            lock.unlock();
+            checkpoint();
+            lock.lock();
+        }
+        auto slice = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+        if (ticksToWait != portMAX_DELAY) {
+            if (std::chrono::steady_clock::now() >= deadline) { return false; }
+            slice = std::min(slice, deadline);
+        }
+        cv.wait_until(lock, slice);
+    }
+    return true;
+}
+
+static void runTask(HostTask* task) {
+    hostSetBoard(task->board);
+    currentTask = task;
+    try {
+        checkpoint();
+        task->code(task->parameters);
+    } catch (const HostTaskDeleted&) {}
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->state = eDeleted;
+    if (!task->started) {
+        task->started = true;
+        taskStarted.notify_all();
+    }
+}
+
+// Starts a task and lets it run until its first FreeRTOS call, as a higher priority task would
+// Tasks of a stopped board are not started
+static void startTask(HostTask* task) {
+    {
+        std::lock_guard<std::mutex> boardLock(task->board->taskMutex);
+        if (task->board->stopRequested) { return; }
+        task->thread = std::thread(runTask, task);
+    }
+    std::unique_lock<std::mutex> lock(task->mutex);
+    taskStarted.wait_for(lock, std::chrono::milliseconds(100), [&] { return task->started; });
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t, void* parameters, UBaseType_t priority, TaskHandle_t* createdTask) {
+    HostTask* task = new HostTask();
+    task->code = code;
+    task->parameters = parameters;
+    task->name = name;
+    task->priority = priority;
+    task->board = hostBoard();
+    if (createdTask) { *createdTask = task; }
+
+    bool running;
+    {
+        std::lock_guard<std::mutex> lock(task->board->taskMutex);
+        task->board->tasks.push_back(task);
+        running = task->board->schedulerStarted;
+    }
+    if (running) { startTask(task); }
+    return pdPASS;
+}
+
+// Starts the board's tasks, highest priority first - like on the board it does not return
+// until the board is stopped, and then only once every task has ended
+void vTaskStartScheduler() {
+    HostBoard* board = hostBoard();
+    std::vector<HostTask*> tasks;
+    {
+        std::lock_guard<std::mutex> lock(board->taskMutex);
+        board->schedulerStarted = true;
+        tasks = board->tasks;
+    }
+    std::stable_sort(tasks.begin(), tasks.end(), [](HostTask* a, HostTask* b) { return a->priority > b->priority; });
+    for (HostTask* task : tasks) { startTask(task); }
+
+    {
+        std::unique_lock<std::mutex> lock(board->taskMutex);
+        board->stopped.wait(lock, [&] { return board->stopRequested; });
+        tasks = board->tasks; // no task starts from here on
+    }
+    for (HostTask* task : tasks) {
+        if (task->thread.joinable()) { task->thread.join(); }
+    }
+}
+
+static HostTask* taskOf(TaskHandle_t handle) {
+    return handle ? static_cast<HostTask*>(handle) : currentTask;
+}
+
+void vTaskSuspend(TaskHandle_t handle) {
+    HostTask* task = taskOf(handle);
+    if (!task) { return; }
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->suspendRequested = true;
+    }
+    if (task == currentTask) { checkpoint(); }
+}
+
+void vTaskResume(TaskHandle_t handle) {
+    HostTask* task = taskOf(handle);
+    if (!task) { return; }
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->suspendRequested = false;
+    task->resumed.notify_all();
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+    HostTask* task = taskOf(handle);
+    if (!task) { return; }
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->deleteRequested = true;
+        task->resumed.notify_all();
+    }
+    if (task == currentTask) { checkpoint(); }
+}
+
+eTaskState eTaskGetState(TaskHandle_t handle) {
+    HostTask* task = taskOf(handle);
+    if (!task) { return eInvalid; }
+    if (task == currentTask) { return eRunning; }
+    std::lock_guard<std::mutex> lock(task->mutex);
+    if (task->deleteRequested) { return eDeleted; }
+    if (task->suspendRequested) { return eSuspended; }
+    return task->state;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+    return 0; // host stacks are not measured
+}
+
+void hostStopBoard(HostBoard* board) {
+    std::lock_guard<std::mutex> boardLock(board->taskMutex);
+    board->stopRequested = true;
+    board->stopped.notify_all();
+    for (HostTask* task : board->tasks) {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->deleteRequested = true;
+        task->resumed.notify_all();
+    }
+}
+
+//Semaphores and mutexes
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable available;
+    UBaseType_t count;
+    UBaseType_t maxCount;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    HostSemaphore* semaphore = new HostSemaphore();
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+    BlockedScope blocked;
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!waitFor(semaphore->available, lock, ticksToWait, [&] { return semaphore->count > 0; })) { return pdFALSE; }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count == semaphore->maxCount) { return pdFALSE; }
+    semaphore->count++;
+    semaphore->available.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higherPriorityTaskWoken) {
+    if (higherPriorityTaskWoken) { *higherPriorityTaskWoken = pdFALSE; }
+    return xSemaphoreGive(semaphore);
+}
+
+//Queues
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    HostQueue* queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait, bool front) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticksToWait, [&] { return queue->items.size() < queue->length; })) { return errQUEUE_FULL; }
+    const uint8_t* bytes = static_cast<const uint8_t*>(item);
+    std::vector<uint8_t> copy(bytes, bytes + queue->itemSize);
+    if (front) { queue->items.push_front(copy); }
+    else { queue->items.push_back(copy); }
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+    BlockedScope blocked;
+    return queueSend(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+    BlockedScope blocked;
+    return queueSend(queue, item, ticksToWait, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken) {
+    (void)higherPriorityTaskWoken; // left as it was - tasks are threads, so no switch is pending
+    return queueSend(queue, item, 0, false);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait) {
+    BlockedScope blocked;
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticksToWait, [&] { return !queue->items.empty(); })) { return pdFALSE; }
+    std::memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->items.size();
+}
+
+//Time
+TickType_t xTaskGetTickCount() {
+    return millis();
+}
+
+TickType_t xTaskGetTickCountFromISR() {
+    return millis();
+}
+
+// Sleeps in short slices so requests from other tasks are seen
+static void sleepFor(uint32_t ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    do {
+        checkpoint();
+        std::this_thread::sleep_until(std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+    } while (std::chrono::steady_clock::now() < deadline);
+    checkpoint();
+}
+
+// Arduino delay busy-waits, so the task stays ready
+void delay(uint32_t ms) {
+    sleepFor(ms);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    BlockedScope blocked;
+    sleepFor(ticks);
+}
+
+void vTaskDelayUntil(TickType_t* previousWakeTime, TickType_t period) {
+    BlockedScope blocked;
+    *previousWakeTime += period;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(*previousWakeTime - now) > 0) { sleepFor(*previousWakeTime - now); }
+}
@@ -0,0 +1,127 @@
+#include <HostBoard.h>
+#include <chrono>
+#include <thread>
+
+//Arduino
+HostSerial Serial;
+TIM_TypeDef hostTimers[2];
+
+static HostBoard defaultBoard;
+static thread_local HostBoard* currentBoard = &defaultBoard;
+
+HostBoard* hostBoard() {
+    return currentBoard;
+}
+
+void hostSetBoard(HostBoard* board) {
+    currentBoard = board ? board : &defaultBoard;
+}
+
+FILE* hostSerialOutput() {
+    if (currentBoard->serial) { return currentBoard->serial; }
+    return Serial.enabled ? stdout : nullptr;
+}
+
+void HostBoard::pinMode(int pin, int mode) {
+    if (pin >= 0 && pin < HOST_PINS) { pinModes[pin] = mode; }
+}
+
+void HostBoard::digitalWrite(int pin, int value) {
+    if (pin >= 0 && pin < HOST_PINS) { pinValues[pin] = value; }
+}
+
+int HostBoard::digitalRead(int pin) {
+    if (pin < 0 || pin >= HOST_PINS) { return HIGH; }
+    return (pinModes[pin] == OUTPUT) ? pinValues[pin] : HIGH;
+}
+
+int HostBoard::analogRead(int) {
+    return 512;
+}
+
+void HostBoard::startTimer(void (*)(), uint32_t) {}
+
+void hostStartTimer(void (*isr)(), uint32_t hz) {
+    currentBoard->startTimer(isr, hz);
+}
+
+void pinMode(int pin, int mode) {
+    currentBoard->pinMode(pin, mode);
+}
+
+void digitalWrite(int pin, int value) {
+    currentBoard->digitalWrite(pin, value != 0);
+}
+
+int digitalRead(int pin) {
+    return currentBoard->digitalRead(pin);
+}
+
+void digitalToggle(int pin) {
+    digitalWrite(pin, !digitalRead(pin));
+}
+
+void analogWrite(int pin, int value) {
+    currentBoard->digitalWrite(pin, value);
+}
+
+void analogWriteResolution(int) {}
+
+//Port and bit of each pin on the Nucleo-L432KC
+struct HostPinMap {
+    int port;
+    int bit;
+};
+
+static const HostPinMap hostPinMap[HOST_PINS] = {
+    {0, 10}, {0, 9}, {0, 12}, {1, 0}, {1, 7}, {1, 6}, {1, 1},  // D0-D6
+    {2, 14}, {2, 15}, {0, 8}, {0, 11}, {1, 5}, {1, 4}, {1, 3}, // D7-D13
+    {0, 0}, {0, 1}, {0, 3}, {0, 4}, {0, 5}, {0, 6}, {0, 7}, {0, 2}, // A0-A7
+    {1, 3} // LED_BUILTIN, D13
+};
+
+GPIO_TypeDef hostPorts[3] = {{{0}, {0}}, {{1}, {1}}, {{2}, {2}}};
+
+void HostPortSetReset::operator=(uint32_t value) {
+    for (int pin = 0; pin < HOST_PINS; pin++) {
+        if (hostPinMap[pin].port != port) { continue; }
+        uint32_t mask = 1u << hostPinMap[pin].bit;
+        if (value & mask) { currentBoard->digitalWrite(pin, HIGH); }
+        else if (value & (mask << 16)) { currentBoard->digitalWrite(pin, LOW); }
+    }
+}
+
+HostPortInput::operator uint32_t() const {
+    uint32_t value = 0;
+    for (int pin = 0; pin < HOST_PINS; pin++) {
+        if (hostPinMap[pin].port != port) { continue; }
+        if (currentBoard->digitalRead(pin)) { value |= 1u << hostPinMap[pin].bit; }
+    }
+    return value;
+}
+
+GPIO_TypeDef* digitalPinToPort(int pin) {
+    return &hostPorts[hostPinMap[pin].port];
+}
+
+uint32_t digitalPinToBitMask(int pin) {
+    return 1u << hostPinMap[pin].bit;
+}
+
+int analogRead(int pin) {
+    return currentBoard->analogRead(pin);
+}
+
+static const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+
+uint32_t micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+uint32_t millis() {
+    return micros() / 1000;
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
@@ -0,0 +1,8 @@
+#ifndef HOST_STM32L4XX_HAL_CORTEX_H
+#define HOST_STM32L4XX_HAL_CORTEX_H
+
+// Host stand-in - ES_CAN.h includes this on the board, only the integer types are used off target
+
+#include <cstdint>
+
+#endif
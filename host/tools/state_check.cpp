@@ -0,0 +1,68 @@
+// State check - how SysState takes settings deltas from other boards
+//
+//   state_check
+//
+// Plays out the orders in which deltas can reach a board: changes to other settings with older
+// generations, two boards changing one setting with the same generation, generations that wrap while
+// a setting is left alone, and deltas that a snapshot already holds. Each case prints its result.
+// The exit code is non-zero if any check fails.
+
+#include <State.h>
+#include <cstdio>
+
+static int checks = 0;
+static int failures = 0;
+
+static void expect(bool ok, const char* what) {
+    checks++;
+    if (!ok) {
+        std::printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+int main() {
+    { // this board turns the volume twice while another changes the waveform from the first generation
+        SysState board;
+        uint8_t first = board.nextGeneration('V', 3);
+        uint8_t second = board.nextGeneration('V', 3);
+        expect(board.acceptDelta('W', first, 5), "a waveform change older than this board's volume changes is taken");
+        expect(!board.acceptDelta('V', first, 1), "a volume change older than this board's last is dropped");
+        expect(board.getGeneration() == second, "an older delta leaves the generation");
+    }
+    { // two boards turn the volume with the same generation
+        SysState board;
+        uint8_t gen = board.nextGeneration('V', 3);
+        expect(board.acceptDelta('V', gen, 1), "the same generation from a lower source wins");
+        expect(!board.acceptDelta('V', gen, 5), "the same generation from a higher source loses");
+        expect(!board.acceptDelta('V', gen, 1), "a repeated delta is dropped");
+    }
+    { // deltas for different settings arrive out of order
+        SysState board;
+        uint8_t gen = board.nextGeneration('V', 3);
+        expect(board.acceptDelta('M', gen + 5, 4), "a later filter mode change is taken");
+        expect(board.getGeneration() == (uint8_t)(gen + 5), "the generation rises to the latest delta");
+        expect(board.acceptDelta('E', gen + 3, 6), "an envelope change behind the generation is taken");
+        expect(board.getGeneration() == (uint8_t)(gen + 5), "the generation does not go back");
+    }
+    { // the generation wraps while the cutoff is left alone
+        SysState board;
+        for (int i = 0; i < 300; i++) { board.nextGeneration('V', 3); }
+        uint8_t gen = board.getGeneration();
+        expect(board.acceptDelta('C', gen, 6), "a cutoff change after the generation wrapped is taken");
+        expect(!board.acceptDelta('C', gen - 100, 6), "a cutoff change from before the wrap is dropped");
+    }
+    { // a snapshot holds the changes up to its generation
+        SysState sender;
+        for (int i = 0; i < 10; i++) { sender.nextGeneration('W', 2); }
+        uint8_t msg[8];
+        sender.packSnapshot(msg);
+        SysState board;
+        board.applySnapshot(msg, false);
+        expect(!board.acceptDelta('V', msg[2], 1), "a delta the snapshot holds is dropped");
+        expect(board.acceptDelta('V', msg[2] + 1, 1), "a delta after the snapshot is taken");
+    }
+
+    std::printf("state     %d of %d checks failed\n", failures, checks);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+// Offline renderer - plays a timestamped event script through the synth engine and writes a WAV
+//
+//   synth_render <script> <out.wav> [--hash]
+//
+// Each script line is "<time ms> <command> [args]", blank lines and # comments are ignored:
+//   press <octave> <note>     release <octave> <note>
+//   keys <28 bit inputs>      a scanKeysTask input bitset as printed by std::bitset::to_string
+//                             (active low, keys 0-11 play in the current octave) e.g. from the looper
+//   octave <1-7>              octave used by keys
+//   volume <0-8>  waveform <0-3>  envelope <0-8>  filter <0-3>  cutoff <0-15>
+//   joyx <0-1023>  joyy <0-1023>
+//   end                       stop here, otherwise the render ends 2 s after the last event
+//
+// Events take effect at the next block boundary (SAMPLE_BUFFER_SIZE samples), exactly as the board
+// sees changes made between renders. Rendering is deterministic: the same script and build always
+// give the same samples, and --hash prints a hash of them for golden output tests.
+// Throughput (samples per second and speed against real time) is printed to stderr.
+
+#include <Arduino.h>
+#include <constants.h>
+#include <waveforms.h>
+#include <Voices.h>
+#include <Filter.h>
+#include <Renderer.h>
+#include <bitset>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+struct ScriptEvent {
+    uint32_t timeMs;
+    std::string command;
+    std::vector<std::string> args;
+    int line;
+};
+
+//Engine state normally held by the board's globals and tasks
+struct Engine {
+    VoicePool pool{STEAL_OLDEST};
+    Renderer renderer;
+    RenderControls controls = {8, 0, 0, FILTER_OFF, FILTER_CUTOFFS - 1};
+    uint8_t cutoff = CUTOFF_SETTINGS - 1;
+    int32_t joyX = 512;
+    uint32_t pitchBend = 1 << 16;
+    uint8_t octave = 4;
+    std::bitset<12> keys = 0xFFF; // released
+};
+
+static bool parseScript(const char* path, std::vector<ScriptEvent>& events) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "cannot open " << path << "\n";
+        return false;
+    }
+    std::string text;
+    int line = 0;
+    while (std::getline(file, text)) {
+        line++;
+        text = text.substr(0, text.find('#'));
+        std::istringstream words(text);
+        ScriptEvent event;
+        if (!(words >> event.timeMs >> event.command)) { continue; }
+        std::string arg;
+        while (words >> arg) { event.args.push_back(arg); }
+        event.line = line;
+        if (!events.empty() && event.timeMs < events.back().timeMs) {
+            std::cerr << path << ":" << line << ": events must be in time order\n";
+            return false;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+static int arg(const ScriptEvent& event, size_t index, int lower, int upper) {
+    if (index >= event.args.size()) { throw std::runtime_error("missing argument"); }
+    int value = std::stoi(event.args[index]);
+    if (value < lower || value > upper) { throw std::runtime_error("argument out of range"); }
+    return value;
+}
+
+//Same as playNotesTask on the receiver
+static void pressKey(Engine& engine, uint8_t octave, uint8_t note, bool pressed) {
+    if (pressed) { engine.pool.noteOn(octave, note, vibratoFunc(octave, note, engine.pitchBend)); }
+    else { engine.pool.noteOff(octave, note); }
+}
+
+static void applyEvent(Engine& engine, const ScriptEvent& event) {
+    const std::string& command = event.command;
+    if (command == "press" || command == "release") {
+        pressKey(engine, arg(event, 0, 0, OCTAVES - 1), arg(event, 1, 0, 11), command == "press");
+    } else if (command == "keys") {
+        if (event.args.empty()) { throw std::runtime_error("missing argument"); }
+        std::bitset<28> inputs(event.args[0]);
+        for (int i = 0; i < 12; i++) {
+            if (inputs[i] != engine.keys[i]) { pressKey(engine, engine.octave, i, !inputs[i]); }
+            engine.keys[i] = inputs[i];
+        }
+    } else if (command == "octave") {
+        engine.octave = arg(event, 0, 1, 7);
+    } else if (command == "volume") {
+        engine.controls.volume = arg(event, 0, 0, 8);
+    } else if (command == "waveform") {
+        engine.controls.waveform = arg(event, 0, 0, 3);
+    } else if (command == "envelope") {
+        engine.controls.envelope = arg(event, 0, 0, ENVELOPE_SETTINGS - 1);
+    } else if (command == "filter") {
+        engine.controls.filterMode = arg(event, 0, 0, FILTER_MODES - 1);
+    } else if (command == "cutoff") {
+        engine.cutoff = arg(event, 0, 0, CUTOFF_SETTINGS - 1);
+    } else if (command == "joyx") {
+        engine.joyX = arg(event, 0, 0, 1023);
+    } else if (command == "joyy") { // as joystickUpdateTask
+        engine.pitchBend = bendMultiplier(arg(event, 0, 0, 1023));
+        engine.pool.retune(engine.pitchBend, vibratoFunc);
+    } else if (command != "end") {
+        throw std::runtime_error("unknown command " + command);
+    }
+    engine.controls.filterCutoff = filterCutoffIndex(engine.cutoff, engine.joyX);
+}
+
+static void writeLE(std::ofstream& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) { out.put((char)((value >> (8 * i)) & 0xFF)); }
+}
+
+static void writeWav(std::ofstream& out, const std::vector<StereoSample>& frames) {
+    uint32_t dataBytes = frames.size() * 4;
+    out.write("RIFF", 4);
+    writeLE(out, 36 + dataBytes, 4);
+    out.write("WAVEfmt ", 8);
+    writeLE(out, 16, 4);              // fmt chunk size
+    writeLE(out, 1, 2);               // PCM
+    writeLE(out, 2, 2);               // stereo
+    writeLE(out, SAMPLE_RATE, 4);
+    writeLE(out, SAMPLE_RATE * 4, 4); // bytes per second
+    writeLE(out, 4, 2);               // bytes per frame
+    writeLE(out, 16, 2);              // bits per sample
+    out.write("data", 4);
+    writeLE(out, dataBytes, 4);
+    for (const StereoSample& frame : frames) { // WAV is signed, the DAC samples are offset by 32768
+        writeLE(out, (uint16_t)(frame.left ^ 0x8000), 2);
+        writeLE(out, (uint16_t)(frame.right ^ 0x8000), 2);
+    }
+}
+
+//FNV-1a over the samples
+static uint64_t hashFrames(const std::vector<StereoSample>& frames) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const StereoSample& frame : frames) {
+        for (uint16_t sample : {frame.left, frame.right}) {
+            hash = (hash ^ (sample & 0xFF)) * 1099511628211ull;
+            hash = (hash ^ (sample >> 8)) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: synth_render <script> <out.wav> [--hash]\n";
+        return 2;
+    }
+    bool printHash = (argc > 3 && std::strcmp(argv[3], "--hash") == 0);
+
+    std::vector<ScriptEvent> events;
+    if (!parseScript(argv[1], events)) { return 1; }
+    uint32_t endMs = events.empty() ? 0 : events.back().timeMs;
+    if (events.empty() || events.back().command != "end") { endMs += 2000; } // release tail
+
+    Engine engine;
+    uint64_t totalSamples = (uint64_t)endMs * SAMPLE_RATE / 1000;
+    uint64_t blocks = (totalSamples + SAMPLE_BUFFER_SIZE - 1) / SAMPLE_BUFFER_SIZE;
+    std::vector<StereoSample> frames(blocks * SAMPLE_BUFFER_SIZE);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t next = 0;
+    for (uint64_t b = 0; b < blocks; b++) {
+        uint64_t blockStartMs = b * SAMPLE_BUFFER_SIZE * 1000 / SAMPLE_RATE;
+        for (; next < events.size() && events[next].timeMs <= blockStartMs; next++) {
+            try {
+                applyEvent(engine, events[next]);
+            } catch (const std::exception& error) {
+                std::cerr << argv[1] << ":" << events[next].line << ": " << error.what() << "\n";
+                return 1;
+            }
+        }
+        engine.renderer.renderBlock(engine.pool, engine.controls, &frames[b * SAMPLE_BUFFER_SIZE]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream out(argv[2], std::ios::binary);
+    if (!out) {
+        std::cerr << "cannot write " << argv[2] << "\n";
+        return 1;
+    }
+    writeWav(out, frames);
+
+    double audioSeconds = frames.size() / (double)SAMPLE_RATE;
+    std::cerr << frames.size() << " frames (" << audioSeconds << " s) in " << seconds * 1000 << " ms, "
+              << frames.size() / seconds << " samples/s, " << audioSeconds / seconds << "x real time\n";
+    if (printHash) { std::printf("hash %016llx\n", (unsigned long long)hashFrames(frames)); }
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Event trace decoder - turns a board's TRACE_EVENTS Serial stream into Chrome trace JSON
+//
+//   trace_decode <capture.bin> <out.json> [--cpu-mhz N]
+//
+// Capture the Serial port to a file (e.g. at TRACE_BAUD with any raw serial logger, or with
+// synth_sim --events), then open the JSON in https://ui.perfetto.dev or chrome://tracing.
+// Every ISR and task gets a track with one slice per call or loop iteration. Note on/off are async
+// slices per note, CAN, queue and underrun records are instant events on their own tracks.
+// Bytes outside valid batches (text printed before the trace started, a cut-off batch) are skipped.
+// Times are cycle counts, unwrapped and converted at --cpu-mhz (default F_CPU).
+
+#include <Arduino.h>
+#include <constants.h>
+#include <TraceRing.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Tracks after the ProfileSlot ones
+enum TraceTrack { TRACK_CAN = 100, TRACK_QUEUES = 101, TRACK_NOTES = 104, TRACK_AUDIO = 105, TRACK_TRACE = 106 };
+
+const char* const QUEUE_NAMES[] = {"msgInQ", "notePlayingQ"};
+
+struct JsonEvent {
+    double ts;
+    std::string json;
+};
+
+//CAN message type as text - a letter of the protocol in globals.h, otherwise its value
+static std::string messageName(uint8_t type) {
+    if (type >= 'A' && type <= 'Z') { return std::string(1, (char)type); }
+    return "0x" + std::to_string(type);
+}
+
+static std::string timeText(double ts) {
+    std::ostringstream text;
+    text.setf(std::ios::fixed);
+    text.precision(3);
+    text << ts;
+    return text.str();
+}
+
+static std::string event(const char* phase, const std::string& name, int track, double ts, const std::string& extra = "") {
+    return "{\"name\":\"" + name + "\",\"ph\":\"" + phase + "\",\"pid\":1,\"tid\":" + std::to_string(track) +
+           ",\"ts\":" + timeText(ts) + extra + "}";
+}
+
+static std::string trackName(int track, const std::string& name) {
+    return "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(track) +
+           ",\"args\":{\"name\":\"" + name + "\"}}";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: trace_decode <capture.bin> <out.json> [--cpu-mhz N]\n";
+        return 2;
+    }
+    double cyclesPerMicro = F_CPU / 1e6;
+    if (argc > 4 && std::strcmp(argv[3], "--cpu-mhz") == 0) { cyclesPerMicro = std::atof(argv[4]); }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::cerr << "cannot open " << argv[1] << "\n";
+        return 1;
+    }
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Batches - magic, count, records - with every record type checked before a batch is taken
+    std::vector<TraceRecord> records;
+    size_t skipped = 0;
+    size_t batches = 0;
+    size_t pos = 0;
+    while (pos + 3 <= bytes.size()) {
+        uint8_t count = bytes[pos + 2];
+        size_t end = pos + 3 + count * sizeof(TraceRecord);
+        bool valid = bytes[pos] == TRACE_MAGIC[0] && bytes[pos + 1] == TRACE_MAGIC[1] &&
+                     count > 0 && count <= TRACE_BATCH + 1 && end <= bytes.size();
+        for (size_t r = pos + 3; valid && r < end; r += sizeof(TraceRecord)) {
+            valid = bytes[r + 4] < TRACE_EVENTS_COUNT;
+        }
+        if (!valid) {
+            pos++;
+            skipped++;
+            continue;
+        }
+        for (size_t r = pos + 3; r < end; r += sizeof(TraceRecord)) {
+            TraceRecord record;
+            record.time = bytes[r] | (bytes[r + 1] << 8) | (bytes[r + 2] << 16) | ((uint32_t)bytes[r + 3] << 24);
+            record.event = bytes[r + 4];
+            record.a = bytes[r + 5];
+            record.b = bytes[r + 6];
+            records.push_back(record);
+        }
+        batches++;
+        pos = end;
+    }
+    skipped += bytes.size() - pos;
+
+    // Cycle counts wrap every 2^32 - records from different writers can be slightly out of order,
+    // so each is placed relative to the previous one
+    std::vector<JsonEvent> events;
+    uint64_t dropped = 0;
+    int64_t now = 0;
+    uint32_t last = records.empty() ? 0 : records[0].time;
+    for (const TraceRecord& record : records) {
+        now += (int32_t)(record.time - last);
+        last = record.time;
+        double ts = now / cyclesPerMicro;
+        std::string name;
+        switch (record.event) {
+            case EVENT_BEGIN:
+            case EVENT_END:
+                if (record.a >= PROFILE_SLOTS) { continue; }
+                events.push_back({ts, event(record.event == EVENT_BEGIN ? "B" : "E", PROFILE_NAMES[record.a], record.a, ts)});
+                break;
+            case EVENT_QUEUE_SEND:
+            case EVENT_QUEUE_RECEIVE:
+                if (record.a > QUEUE_NOTE_PLAYING) { continue; }
+                name = std::string(record.event == EVENT_QUEUE_SEND ? "send " : "receive ") + messageName(record.b);
+                events.push_back({ts, event("i", name, TRACK_QUEUES + record.a, ts, ",\"s\":\"t\"")});
+                break;
+            case EVENT_CAN_TX:
+            case EVENT_CAN_RX:
+                name = std::string(record.event == EVENT_CAN_TX ? "TX " : "RX ") + messageName(record.a) + " " + std::to_string(record.b);
+                events.push_back({ts, event("i", name, TRACK_CAN, ts, ",\"s\":\"t\"")});
+                break;
+            case EVENT_NOTE_ON:
+            case EVENT_NOTE_OFF:
+                if (record.b >= 12) { continue; }
+                name = std::string(NOTE_NAMES[record.b]) + std::to_string(record.a);
+                events.push_back({ts, event(record.event == EVENT_NOTE_ON ? "b" : "e", name, TRACK_NOTES, ts,
+                                            ",\"cat\":\"note\",\"id\":" + std::to_string(record.a * 12 + record.b))});
+                break;
+            case EVENT_UNDERRUN:
+                events.push_back({ts, event("i", "underrun", TRACK_AUDIO, ts, ",\"s\":\"t\"")});
+                break;
+            case EVENT_DROPPED:
+                dropped += record.a | (record.b << 8);
+                events.push_back({ts, event("i", "dropped " + std::to_string(record.a | (record.b << 8)), TRACK_TRACE, ts, ",\"s\":\"t\"")});
+                break;
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), [](const JsonEvent& a, const JsonEvent& b) { return a.ts < b.ts; });
+
+    std::ofstream out(argv[2]);
+    if (!out) {
+        std::cerr << "cannot write " << argv[2] << "\n";
+        return 1;
+    }
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (int slot = 0; slot < PROFILE_SLOTS; slot++) { out << trackName(slot, PROFILE_NAMES[slot]) << ",\n"; }
+    out << trackName(TRACK_CAN, "CAN") << ",\n";
+    for (int queue = 0; queue <= QUEUE_NOTE_PLAYING; queue++) { out << trackName(TRACK_QUEUES + queue, QUEUE_NAMES[queue]) << ",\n"; }
+    out << trackName(TRACK_NOTES, "notes") << ",\n";
+    out << trackName(TRACK_AUDIO, "audio") << ",\n";
+    out << trackName(TRACK_TRACE, "trace");
+    for (const JsonEvent& e : events) { out << ",\n" << e.json; }
+    out << "\n]}\n";
+
+    std::cerr << records.size() << " records in " << batches << " batches, " << dropped << " dropped on the board, "
+              << skipped << " bytes skipped, " << timeText(now / cyclesPerMicro / 1000) << " ms\n";
+    return records.empty() ? 1 : 0;
+}
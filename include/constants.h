@@ -34,12 +34,99 @@ const int DRST_BIT = 4;
 const int HKOW_BIT = 5;
 const int HKOE_BIT = 6;
 
+//Key matrix settle time - after a row is enabled its columns are read, and its output bit latched,
+//this long later. The columns are pulled up, so they settle well within it
+const uint32_t KEY_SETTLE_US = 2;
+
+//Key Scan Timing
+// The key matrix is sampled and debounced every KEY_SCAN_PERIOD, and debounced changes are handled at
+// once. The looper, the key state refresh and the transmitter press run every KEY_TICK_SCANS samples,
+// at the 20 ms they were written for
+const TickType_t KEY_SCAN_PERIOD = pdMS_TO_TICKS(1);
+const uint8_t KEY_TICK_SCANS = 20;
+// Most a scan may wake late on the board - any later and a sample was skipped, which the debouncing
+// counts on. At the highest priority only ISRs and short critical sections can hold it up
+const uint32_t SCAN_JITTER_LIMIT_US = KEY_SCAN_PERIOD * portTICK_PERIOD_MS * 1000;
+
 //Constants
 //New Connection Stabilisation Time
 const TickType_t CONN_TIME = pdMS_TO_TICKS(10);
 
-//Accumulators - number of playable concurrent notes (10 fingers)
-const int ACCUMULATORS = 10;
+//New Board Start Time - a new neighbour gets the settings and octave range this long after it is connected
+const TickType_t CONN_BOOT_TIME = pdMS_TO_TICKS(1000);
+
+//Handshake Timing
+// Pins are polled every tick and messages wake the handshake at once. Only the absence of a neighbour
+// cannot be signalled, so a board waits HANDSHAKE_SETTLE from startup before it decides it is at an
+// end of the stack. The other two are fallbacks - a claim no board acknowledges, and a final message
+// that never comes after boards further east have claimed their positions
+const TickType_t HANDSHAKE_POLL = pdMS_TO_TICKS(1);
+const TickType_t HANDSHAKE_SETTLE = pdMS_TO_TICKS(100);
+const TickType_t HANDSHAKE_ACK_TIME = pdMS_TO_TICKS(10);
+const TickType_t HANDSHAKE_TIMEOUT = pdMS_TO_TICKS(500);
+
+//Key State Refresh - 20 ms key scan ticks between repeats of an unchanged key state frame (500 ms)
+const uint8_t KEYS_REFRESH_SCANS = 25;
+
+//CAN Message IDs - class in bits 8-10, sending board in bits 0-2
+//The lowest ID wins bus arbitration, so key frames go first and config changes last. The sending board is
+//its position during the handshake and its assigned octave (keySource) after it, which keeps its IDs apart
+//from the other boards' even when knob 2 moves two boards onto the same octave
+enum CanClass {
+    CAN_CLASS_KEYS,   // (K)ey states
+    CAN_CLASS_SYNC,   // trace (S)ync
+    CAN_CLASS_STATE,  // handshake and connections - N, F, H, L, T
+    CAN_CLASS_CONFIG  // settings - V, W, E, C, M and the state snapshot A and its request R
+};
+const uint32_t CAN_CLASS_SHIFT = 8;
+const uint32_t CAN_CLASS_MASK = 0x700;
+const uint32_t CAN_SOURCE_MASK = 0x007;
+
+//Receive filters - keys and sync to FIFO 0, handled in its ISR, everything else to FIFO 1 and the decode task
+const uint32_t CAN_FAST_ID = CAN_CLASS_KEYS << CAN_CLASS_SHIFT;
+const uint32_t CAN_FAST_MASK = 0x600; // classes 0 and 1
+
+inline uint32_t canMessageId(uint8_t type, uint8_t source) {
+    uint32_t canClass;
+    switch (type) {
+        case 'K': canClass = CAN_CLASS_KEYS; break;
+        case 'S': canClass = CAN_CLASS_SYNC; break;
+        case 'V': case 'W': case 'E': case 'C': case 'M': case 'A': case 'R': canClass = CAN_CLASS_CONFIG; break;
+        default: canClass = CAN_CLASS_STATE; break;
+    }
+    return (canClass << CAN_CLASS_SHIFT) | (source & CAN_SOURCE_MASK);
+}
+
+//Accumulators - number of playable concurrent notes (enough for a full 7 board stack)
+const int ACCUMULATORS = 32;
+
+//Mix Headroom - the mix is shifted down by this before the output clamps, louder chords saturate
+const int MIX_HEADROOM = 3;
+
+//Pitch Bend - range of the joystick Y bend in semitones each direction
+const int BEND_RANGE = 2;
+
+//Envelope - knob 0 sets the attack and release time, decay and sustain are fixed
+const int ENVELOPE_SETTINGS = 9;
+const uint16_t ENVELOPE_TIMES_MS[ENVELOPE_SETTINGS] = {3, 10, 25, 50, 100, 200, 400, 800, 1600};
+const uint16_t DECAY_TIME_MS = 200;
+const uint16_t SUSTAIN_LEVEL = 24576; // Q15 - 75% of full scale
+
+//Filter - knob 0 sets the cutoff when switched to the filter (knob 2 press), joystick X sweeps it
+//Chamberlin filters become unstable near fs / 4, so the top cutoff stays well below that
+const int CUTOFF_SETTINGS = 16;
+const int FILTER_MODES = 4;
+const int FILTER_CUTOFFS = 128;
+constexpr double FILTER_MIN_HZ = 60;
+constexpr double FILTER_MAX_HZ = 4000;
+const int32_t FILTER_DAMPING = 16384; // Q15 - 1 / resonance, 0.5 gives a gentle peak at the cutoff
+
+//Sample Buffer - samples rendered per block into each half of the double buffer (32 - 128)
+//Larger blocks cost less per sample but add up to 2 blocks of output latency
+const uint32_t SAMPLE_BUFFER_SIZE = 64;
+
+//Output resolution - samples are rendered at 16 bits and reduced to the DAC width in sampleISR
+const int DAC_BITS = 12;
 
 //Stack Sizes
 const int HANDSHAKE_SIZE = 64;
@@ -48,41 +135,90 @@ const int PLAYNOTES_SIZE = 64;
 const int JOYSTICK_SIZE  = 128;
 const int DISPLAY_SIZE   = 256;
 const int DECODE_SIZE    = 64;
-const int TRANSMIT_SIZE  = 32;
+const int CONNECTIONS_SIZE = 64;
+const int RENDER_SIZE    = 128;
+const int TRACE_DRAIN_SIZE = 128; // Serial.write
+
+//Profiling and Tracing - one slot per ISR and task, in profiles[] and trace records
+enum ProfileSlot {
+    PROFILE_SAMPLE_ISR, PROFILE_CAN_RX_KEYS_ISR, PROFILE_CAN_RX_ISR,
+    PROFILE_HANDSHAKE, PROFILE_SCAN_KEYS, PROFILE_PLAY_NOTES, PROFILE_JOYSTICK, PROFILE_DISPLAY,
+    PROFILE_DECODE, PROFILE_CONNECTIONS, PROFILE_RENDER, PROFILE_TRACE_DRAIN, PROFILE_MATRIX_SCAN, PROFILE_SLOTS
+};
+const char* const PROFILE_NAMES[PROFILE_SLOTS] = {
+    "sampleISR", "CAN_RX_KEYS_ISR", "CAN_RX_ISR",
+    "handshake", "scanKeys", "playNotes", "joystickUpdate", "displayUpdate",
+    "decodeMessage", "connections", "audioRender", "traceDrain", "matrixScan"
+};
 
 //Notes
 const std::bitset<28> NOTE_MASK = 0xFFF;
 const char NOTE_NAMES[12][3] = {"C", "C#", "D", "Eb", "E", "F", "F#", "G", "G#", "A", "Bb", "B"};
 
 //Step Sizes
-const int INDEX_A = 10;
-const uint32_t FREQ_A = 440; //frequency of the "a" note in octave 4
+//Tuning is chosen at compile time - changing it only changes the table contents, never the runtime cost
+const int INDEX_A = 9;
+constexpr double FREQ_A = 440; //frequency of the "a" note in octave 4 - e.g. 432 or 442 for other reference pitches
 const uint32_t SAMPLE_RATE = 22000;
-constexpr uint32_t constructStepSizes(int index) {
-    uint32_t frequency = (uint32_t)(FREQ_A * cx::pow(2,(index - INDEX_A) / 12.0)); // Shift by 12 (divide by 2, 12 times)
-    uint32_t scalar = cx::pow(2,32) / SAMPLE_RATE;
-    return scalar * frequency;
+const int OCTAVES = 8; //octaves 0 - 7
+const int FINE_TUNE_STEPS = 1; //fine tune positions per note, 100 / FINE_TUNE_STEPS cents apart (1 = notes only)
+
+enum Temperament { EQUAL_TEMPERAMENT, JUST_INTONATION };
+constexpr Temperament TEMPERAMENT = EQUAL_TEMPERAMENT;
+const int JUST_ROOT = 0; //key the just intonation ratios are built from (0 = C)
+constexpr double JUST_RATIOS[12] = { // 5-limit ratios from the root
+    1.0, 16.0/15, 9.0/8, 6.0/5, 5.0/4, 4.0/3, 45.0/32, 3.0/2, 8.0/5, 5.0/3, 9.0/5, 15.0/8
+};
+
+constexpr double noteFrequency(int octave, int index) {
+    int semitone = 12 * octave + index;
+    if (TEMPERAMENT == JUST_INTONATION) {
+        // Ratio within the root's octave, scaled so that the "a" note in octave 4 stays at FREQ_A
+        int semitoneA = 12 * 4 + INDEX_A;
+        int octaveShift = (semitone - JUST_ROOT + 120) / 12 - (semitoneA - JUST_ROOT + 120) / 12;
+        double ratio = JUST_RATIOS[(semitone - JUST_ROOT + 120) % 12] / JUST_RATIOS[(semitoneA - JUST_ROOT + 120) % 12];
+        return FREQ_A * ratio * cx::pow(2.0, octaveShift);
+    }
+    return FREQ_A * cx::pow(2, (semitone - 12 * 4 - INDEX_A) / 12.0); // Shift by 12 (divide by 2, 12 times)
 }
-const uint32_t stepSizes[12] = {
-    /*
-    NOTE: This function had an error when calling the "pow" function in constructStepSizes() from math.h as is not a constexpr.
-    We have tried to use cmath.h std::pow which uses constexpr but PlatformIO still compiled the code using math.h
-    In order to fix this we have included a cx_math.h file with its source and license commented in /include/cx_math.h
-    The code was still able to run fully functionally with the error but has been fixed in order to ensure compliance with
-    constexpr requirements and maintain compatibility with all platforms and toolchains
-    */
-    constructStepSizes(0),
-    constructStepSizes(1),
-    constructStepSizes(2),
-    constructStepSizes(3),
-    constructStepSizes(4),
-    constructStepSizes(5),
-    constructStepSizes(6),
-    constructStepSizes(7),
-    constructStepSizes(8),
-    constructStepSizes(9),
-    constructStepSizes(10),
-    constructStepSizes(11)
+
+constexpr uint32_t constructStepSizes(int octave, int index, int fine) {
+    double cents = 100.0 * fine / FINE_TUNE_STEPS;
+    double frequency = noteFrequency(octave, index) * cx::pow(2, cents / 1200.0);
+    double scalar = cx::pow(2,32) / SAMPLE_RATE;
+    return (uint32_t)(scalar * frequency + 0.5);
+}
+
+/*
+NOTE: This function had an error when calling the "pow" function in constructStepSizes() from math.h as is not a constexpr.
+We have tried to use cmath.h std::pow which uses constexpr but PlatformIO still compiled the code using math.h
+In order to fix this we have included a cx_math.h file with its source and license commented in /include/cx_math.h
+The code was still able to run fully functionally with the error but has been fixed in order to ensure compliance with
+constexpr requirements and maintain compatibility with all platforms and toolchains
+*/
+struct StepSizeTable {
+    uint32_t step[OCTAVES][12][FINE_TUNE_STEPS];
 };
 
+constexpr StepSizeTable constructStepSizeTable() {
+    StepSizeTable table = {};
+    for (int octave = 0; octave < OCTAVES; octave++) {
+        for (int index = 0; index < 12; index++) {
+            for (int fine = 0; fine < FINE_TUNE_STEPS; fine++) {
+                table.step[octave][index][fine] = constructStepSizes(octave, index, fine);
+            }
+        }
+    }
+    return table;
+}
+
+constexpr StepSizeTable stepSizeTable = constructStepSizeTable();
+
+//Final step size of a note - indexes outside 0 - 11 move into the neighbouring octave
+constexpr uint32_t stepSizeFor(int octave, int index, int fine = 0) {
+    int semitone = 12 * octave + index;
+    semitone = (semitone < 0) ? 0 : (semitone > 12 * OCTAVES - 1) ? 12 * OCTAVES - 1 : semitone;
+    return stepSizeTable.step[semitone / 12][semitone % 12][fine];
+}
+
 #endif
\ No newline at end of file
@@ -1,5 +1,5 @@
 /**
- * @brief Extracted functions specifically related to cx::pow sourced from https://github.com/elbeno/constexpr
+ * @brief Extracted functions specifically related to cx::pow and cx::sin sourced from https://github.com/elbeno/constexpr
  *
  * Use permitted under the terms of the MIT License.
  *
@@ -50,6 +50,14 @@
 // long double log2(long double x);
 // double log2(Integral x);
 
+// -----------------------------------------------------------------------------
+// trigonometric functions
+
+// float sin(float x);
+// double sin(double x);
+// long double sin(long double x);
+// double sin(Integral x);
+
 // -----------------------------------------------------------------------------
 // power function
 
@@ -97,10 +105,18 @@ namespace cx
   {
     // test whether values are within machine epsilon, used for algorithm
     // termination
+    // local abs so that termination does not depend on which abs overloads
+    // the platform headers bring into scope (an integer abs ends the series early)
+    template <typename T>
+    constexpr T fabs(T x)
+    {
+      return x >= T{0} ? x : -x;
+    }
+
     template <typename T>
     constexpr bool feq(T x, T y)
     {
-      return abs(x - y) <= std::numeric_limits<T>::epsilon();
+      return fabs(x - y) <= std::numeric_limits<T>::epsilon();
     }
   }
 
@@ -174,6 +190,36 @@ namespace cx
     return detail::exp<double>(x, 1.0, 1.0, 2, x);
   }
 
+  //----------------------------------------------------------------------------
+  // sin by Taylor series expansion
+  // accuracy is best for |x| <= pi - reduce the argument before calling
+  namespace detail
+  {
+    template <typename T>
+    constexpr T sin_series(T x, T sum, T n, int i, int s, T t)
+    {
+      return feq(sum, sum + t*s/n) ?
+        sum :
+        sin_series(x, sum + t*s/n, n*i*(i+1), i+2, -s, t*x*x);
+    }
+  }
+  template <typename FloatingPoint>
+  constexpr FloatingPoint sin(
+      FloatingPoint x,
+      typename std::enable_if<std::is_floating_point<FloatingPoint>::value>::type* = nullptr)
+  {
+    return true ?
+      detail::sin_series(x, x, FloatingPoint{6}, 4, -1, x*x*x) :
+      throw err::sin_runtime_error;
+  }
+  template <typename Integral>
+  constexpr double sin(
+      Integral x,
+      typename std::enable_if<std::is_integral<Integral>::value>::type* = nullptr)
+  {
+    return sin<double>(x);
+  }
+
   //----------------------------------------------------------------------------
   // natural logarithm using
   // https://en.wikipedia.org/wiki/Natural_logarithm#High_precision
@@ -4,7 +4,14 @@
 #include <U8g2lib.h>
 #include <STM32FreeRTOS.h>
 #include <Knob.h>
+#include <ES_IO.h>
 #include <State.h>
+#include <AudioBuffer.h>
+#include <Voices.h>
+#include <Profiler.h>
+#include <LatencyTrace.h>
+#include <TraceRing.h>
+#include <KeyFrame.h>
 #include <constants.h>
 
 //Globals
@@ -18,7 +25,9 @@ TaskHandle_t playNotesHandle = NULL;
 TaskHandle_t joystickUpdateHandle = NULL;
 TaskHandle_t displayUpdateHandle = NULL;
 TaskHandle_t decodeMessageHandle = NULL;
-TaskHandle_t transmitMessageHandle = NULL;
+TaskHandle_t connectionsHandle = NULL;
+TaskHandle_t audioRenderHandle = NULL;
+TaskHandle_t traceDrainHandle = NULL;
 
 //System State
 // Use malloc if stack too large - requires ~State() destructor
@@ -30,25 +39,89 @@ SysState sysState;
 // Use malloc if stack too large - requires ~Knob() destructor
 // e.g. Knob* knobs[4]; then knob[i] = new Knob(); in setup
 // Knob->getRotation() to get rotation
-// Button: knob[0] = loop record, knob[1] = loop stop, knob[2] = ?       knob[3] = set receiver
-// Rotate: knob[0] = ?,           knob[1] = waveform,  knob[2] = octave, knob[3] = volume
+// Button: knob[0] = loop record, knob[1] = loop stop, knob[2] = knob 0 envelope/cutoff, knob[3] = set receiver
+// Rotate: knob[0] = envelope or filter cutoff, knob[1] = waveform, knob[2] = octave, knob[3] = volume
+// Joystick: X = filter cutoff sweep, Y = pitch bend, button = filter mode
 Knob knobs[4];
 
+//Key Matrix
+// Rows, columns and output mux bits, shared by scanKeysTask, the handshake, the knobs and resetConnsRead
+KeyMatrix keyMatrix;
+
 //CAN Communication
-// 0 - (P)ressed, (R)eleased, (N)ew HS, (F)inish HS, (V)olume, (W)aveform, (H)ighest Octave, (L)owest Octave, (T)ransmitter
-// 1 - Octave(1-7) / Position(0-255) on startup
-// 2 - Note number(0-11) / Assign(1/0) on octave change
-// 3 - Volume(0-8) / Waveform (0-3)
+// ID - message class and sending board, canMessageId in constants.h
+// 0 - (K)ey states, (N)ew HS, (F)inish HS, (V)olume, (W)aveform, (E)nvelope, (C)utoff, filter (M)ode, (H)ighest Octave, (L)owest Octave, (T)ransmitter, trace (S)ync, st(A)te snapshot, snapshot (R)equest
+// 1 - Octave(1-7) / Position(0-255) on startup / Source (keySource) of a settings change
+// 2 - Key frame sequence number / Assign(1/0) on octave change / Generation of a settings change
+// 3 - Volume(0-8) / Waveform (0-3) / Envelope (0-8) / Cutoff (0-15) / Filter mode (0-3)
 // 4 - Connections None(0b00), East(0b01), West(0b10), Both(0b11)
-QueueHandle_t msgInQ, msgOutQ, notePlayingQ; // CAN message queues
-SemaphoreHandle_t CAN_TX_Semaphore;
+// 3-4 - Held notes in a key frame instead, layout in KeyFrame.h
+// 1-7 - Settings, octave range and receiver in a snapshot instead, layout in State.h
+// 5-7 - Key scan time of a key frame with a new press / receiver's time in a sync, 24 bit us - only with TRACE_LATENCY
+// Outgoing messages wait in ES_CAN's transmit ring, see CAN_TX
+QueueHandle_t msgInQ, notePlayingQ; // CAN message queues
+
+//Connection Readings
+// {west, east} handshake inputs, sent by scanKeysTask each time they change and debounced by connectionsTask
+QueueHandle_t connsQ;
+
+//Handshake
+// While the startup handshake runs, CAN_RX_ISR passes its N and F messages to handshakeQ instead of
+// the decode task, and CAN_TX_ISR gives handshakeAck each time a frame is acknowledged on the bus
+QueueHandle_t handshakeQ;
+SemaphoreHandle_t handshakeAck;
+bool handshaking = true;
+
+//State Replication
+// Settings changes go out as deltas stamped with the next generation. A board that joins a running
+// stack requests a snapshot and, until it arrives, takes the octave range and receiver from one too
+bool joining = false;
+
+//CAN Receive Drops
+// Frames the RX ISRs took from FIFO 0 (key frames) and FIFO 1 (the rest) but found no room for in their queue
+// FIFO overruns are counted by ES_CAN, see CAN_GetOverruns
+uint32_t canRxDropped[2] = {0, 0};
+
+//Key States
+// Last note state received from each board and octave, only used by playNotesTask
+KeyStates keyStates;
+
+//Key Frame Source
+// Identifies this board in its key frames - the octave the handshake or a join assigned it, which is
+// unique in the stack and stays put when knob 2 moves the octave the board plays
+uint8_t keySource = 0;
+
+//Audio Sample Buffer
+// Written in blocks by audioRenderTask, read one sample at a time by sampleISR
+AudioBuffer audioBuffer;
+
+//Voices Playing
+// Notes map to fixed voice slots - bit i of getActiveMask() is set while voice i sounds
+VoicePool voicePool(STEAL_OLDEST);
+
+//Pitch Bend
+// Q16 multiplier from the joystick, applied to new voices straight away
+volatile uint32_t pitchBend = 1 << 16;
+
+//Filter Cutoff
+// Index into the cutoff table from knob 0 and joystick X, read by the renderer once per block
+volatile uint8_t filterCutoff = FILTER_CUTOFFS - 1;
+
+//Profiling
+// Cycles per ISR call and per task loop iteration (slots in constants.h), recorded when PROFILE_TASKS is defined in main.cpp
+ProfileStats profiles[PROFILE_SLOTS];
+
+//Scan Jitter
+// Cycles each scanKeysTask wake-up was early or late against its 1 ms period, recorded with PROFILE_TASKS
+ProfileStats scanJitter;
 
-//Step Sizes
-volatile uint32_t currentStepSize[ACCUMULATORS] = {0};
-SemaphoreHandle_t stepSizeMutex;
+//Latency Tracing
+// Receiver's clock and the stage latencies of key presses, used when TRACE_LATENCY is defined in main.cpp
+TraceClock traceClock;
+LatencyTrace latencyTrace;
 
-//Notes & Octaves Playing
-volatile uint32_t notesPlaying[ACCUMULATORS][2] = {{999,4}, {999,4}, {999,4}, {999,4}, {999,4}, {999,4}, {999,4}, {999,4}, {999,4}, {999,4}};
-SemaphoreHandle_t notesPlayingMutex;
+//Event Trace
+// Task, queue, CAN, note and underrun records from every task and ISR, used when TRACE_EVENTS is defined in main.cpp
+TraceRing traceRing;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include <AudioBuffer.h>
+
+AudioBuffer::AudioBuffer() {
+    for (uint32_t i = 0; i < SAMPLE_BUFFER_SIZE; i++) {
+        buffer[0][i] = {32768, 32768}; // midpoint until the first block is rendered
+        buffer[1][i] = {32768, 32768};
+    }
+    semaphore = xSemaphoreCreateBinary();
+    xSemaphoreGive(semaphore); // first block is rendered straight away
+}
+
+StereoSample AudioBuffer::nextSample(BaseType_t* higherPriorityTaskWoken) {
+    if (readCtr == SAMPLE_BUFFER_SIZE) {
+        readCtr = 0;
+        if (blockReady) {
+            writeBuffer1 = !writeBuffer1;
+            blockReady = false;
+            xSemaphoreGiveFromISR(semaphore, higherPriorityTaskWoken);
+        } else if (primed) {
+            // Render missed its deadline - replay the current half rather than read one being written
+            underruns = underruns + 1;
+        }
+    }
+    return writeBuffer1 ? buffer[0][readCtr++] : buffer[1][readCtr++];
+}
+
+StereoSample* AudioBuffer::beginWrite() {
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+    return writeBuffer1 ? buffer[1] : buffer[0];
+}
+
+void AudioBuffer::endWrite() {
+    blockReady = true;
+    primed = true;
+}
+
+uint32_t AudioBuffer::getUnderruns() const {
+    return __atomic_load_n(&underruns,__ATOMIC_RELAXED);
+}
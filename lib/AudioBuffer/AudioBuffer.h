@@ -0,0 +1,36 @@
+#ifndef AUDIOBUFFER_H
+#define AUDIOBUFFER_H
+
+#include <STM32FreeRTOS.h>
+#include <constants.h>
+#include <AudioOut.h>
+
+// Ping-pong sample buffer between the render task (one writer) and sampleISR (one reader)
+// The render task fills one half while the ISR plays the other, halves swap when both are done
+// Frames are unsigned 16 bit stereo, centred on 32768 - the output driver drops the bits its DAC lacks
+class AudioBuffer {
+    private:
+        StereoSample buffer[2][SAMPLE_BUFFER_SIZE];
+        volatile bool writeBuffer1 = false;
+        volatile bool blockReady = false;
+        volatile bool primed = false;
+        uint32_t readCtr = 0;
+        volatile uint32_t underruns = 0;
+        SemaphoreHandle_t semaphore;
+
+    public:
+        AudioBuffer();
+
+        // ISR side - returns the next sample and swaps halves at the end of a block
+        StereoSample nextSample(BaseType_t* higherPriorityTaskWoken);
+
+        // Task side - blocks until a half is free, then returns it for rendering
+        StereoSample* beginWrite();
+
+        // Task side - marks the rendered half as ready to be swapped in
+        void endWrite();
+
+        uint32_t getUnderruns() const;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include <AudioOut.h>
+#include <constants.h>
+
+#if defined(DAC1) && !defined(AUDIO_ANALOGWRITE)
+void audioOutInit() {
+    // Let the core set up the pins, DAC clock and channels once, then bypass it per sample
+    analogWriteResolution(DAC_BITS);
+    analogWrite(OUTR_PIN, 1 << (DAC_BITS - 1)); // PA4 - DAC channel 1
+    analogWrite(OUTL_PIN, 1 << (DAC_BITS - 1)); // PA5 - DAC channel 2
+}
+
+void audioOutWrite(StereoSample sample) {
+    // 12 bit right aligned dual register - channel 1 in the low half, channel 2 in the high half
+    DAC1->DHR12RD = (sample.right >> (16 - DAC_BITS)) | ((uint32_t)(sample.left >> (16 - DAC_BITS)) << 16);
+}
+
+#elif defined(DAC1)
+void audioOutInit() {
+    analogWriteResolution(DAC_BITS);
+}
+
+void audioOutWrite(StereoSample sample) {
+    analogWrite(OUTL_PIN, sample.left >> (16 - DAC_BITS));
+    analogWrite(OUTR_PIN, sample.right >> (16 - DAC_BITS));
+}
+
+#else
+static StereoSample capture[AUDIO_CAPTURE_SIZE];
+static uint32_t captured = 0;
+
+void audioOutInit() {
+    audioOutClearCapture();
+}
+
+void audioOutWrite(StereoSample sample) {
+    capture[captured % AUDIO_CAPTURE_SIZE] = sample;
+    captured++;
+}
+
+uint32_t audioOutCaptured() {
+    return captured;
+}
+
+StereoSample audioOutCapture(uint32_t index) {
+    return capture[index % AUDIO_CAPTURE_SIZE];
+}
+
+void audioOutClearCapture() {
+    captured = 0;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef AUDIOOUT_H
+#define AUDIOOUT_H
+
+#include <Arduino.h>
+
+// Audio output driver - writes one stereo frame per call from sampleISR
+// On the STM32 both DAC channels are set with one store to the dual data holding register,
+// with no pin map lookups or HAL calls per sample. Off target (no DAC1) the frames are
+// captured in memory instead, so the signal path can be run and checked on a host.
+// Define AUDIO_ANALOGWRITE to go back to analogWrite for comparison with TEST_SAMPLE_ISR
+
+//Left and right 16 bit unsigned samples, centred on 32768
+struct StereoSample {
+    uint16_t left;
+    uint16_t right;
+};
+
+//Configures both DAC channels - call once before the sample timer starts
+void audioOutInit();
+
+//Writes one frame, reduced to DAC_BITS
+void audioOutWrite(StereoSample sample);
+
+#ifndef DAC1
+//Host capture of the frames written, by frame number - keeps the last AUDIO_CAPTURE_SIZE frames
+const uint32_t AUDIO_CAPTURE_SIZE = 4096;
+
+uint32_t audioOutCaptured();
+
+StereoSample audioOutCapture(uint32_t index);
+
+void audioOutClearCapture();
+#endif
+
+#endif
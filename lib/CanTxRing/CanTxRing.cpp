@@ -0,0 +1,71 @@
+#include <CanTxRing.h>
+#include <cstring>
+
+static bool sameKind(const CanTxFrame& frame, uint32_t id, const uint8_t data[8]) {
+    return frame.id == id && frame.data[0] == data[0] && frame.data[1] == data[1];
+}
+
+bool CanTxRing::dropReplaced(uint32_t id, const uint8_t data[8]) {
+    for (uint8_t i = 0; i < urgentCount; i++) {
+        CanTxFrame& older = urgentFrames[(urgentHead + i) % CAN_TX_URGENT_SIZE];
+        bool replaced = sameKind(older, id, data);
+        for (uint8_t j = i + 1; j < urgentCount && !replaced; j++) {
+            replaced = sameKind(urgentFrames[(urgentHead + j) % CAN_TX_URGENT_SIZE], older.id, older.data);
+        }
+        if (!replaced) { continue; }
+        for (uint8_t j = i; j > 0; j--) { // close the gap from the front, the oldest messages move up one
+            urgentFrames[(urgentHead + j) % CAN_TX_URGENT_SIZE] = urgentFrames[(urgentHead + j - 1) % CAN_TX_URGENT_SIZE];
+        }
+        urgentHead = (urgentHead + 1) % CAN_TX_URGENT_SIZE;
+        urgentCount--;
+        return true;
+    }
+    return false;
+}
+
+bool CanTxRing::push(uint32_t id, const uint8_t data[8], bool urgent) {
+    CanTxFrame* ring = urgent ? urgentFrames : frames;
+    uint8_t& ringHead = urgent ? urgentHead : head;
+    uint8_t& ringCount = urgent ? urgentCount : count;
+    uint8_t size = urgent ? CAN_TX_URGENT_SIZE : CAN_TX_RING_SIZE;
+
+    bool full = ringCount == size;
+    if (full) {
+        __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+        if (!urgent || !dropReplaced(id, data)) { return false; }
+    }
+
+    CanTxFrame& frame = ring[(ringHead + ringCount) % size];
+    frame.id = id;
+    std::memcpy(frame.data, data, 8);
+    __atomic_store_n(&ringCount, ringCount + 1, __ATOMIC_RELAXED);
+    uint8_t level = count + urgentCount;
+    if (level > highWater) { __atomic_store_n(&highWater, level, __ATOMIC_RELAXED); }
+    return !full;
+}
+
+bool CanTxRing::pop(CanTxFrame& frame) {
+    if (urgentCount) {
+        frame = urgentFrames[urgentHead];
+        urgentHead = (urgentHead + 1) % CAN_TX_URGENT_SIZE;
+        __atomic_store_n(&urgentCount, urgentCount - 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    if (!count) { return false; }
+    frame = frames[head];
+    head = (head + 1) % CAN_TX_RING_SIZE;
+    __atomic_store_n(&count, count - 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+uint8_t CanTxRing::getLevel() const {
+    return __atomic_load_n(&count, __ATOMIC_RELAXED) + __atomic_load_n(&urgentCount, __ATOMIC_RELAXED);
+}
+
+uint8_t CanTxRing::getHighWater() const {
+    return __atomic_load_n(&highWater, __ATOMIC_RELAXED);
+}
+
+uint32_t CanTxRing::getDropped() const {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
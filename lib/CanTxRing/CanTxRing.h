@@ -0,0 +1,59 @@
+#ifndef CANTXRING_H
+#define CANTXRING_H
+
+#include <Arduino.h>
+
+// Transmit ring - CAN messages waiting for a free transmit mailbox
+// CAN_TX adds a message and returns, and the mailbox empty interrupt moves the next message into
+// the mailbox it frees, so no task waits for the bus. Urgent messages (key frames) wait in a
+// separate short ring that is always emptied first, so they pass everything else but keep their
+// own order. The rings do no locking of their own - ES_CAN only uses them from tasks with the
+// scheduler suspended and the transmit interrupt masked, or from the transmit interrupt.
+
+//Messages each ring holds - 32 is about 40 ms of a saturated bus at 125 kbit/s
+const uint8_t CAN_TX_RING_SIZE = 32;
+const uint8_t CAN_TX_URGENT_SIZE = 8;
+
+struct CanTxFrame {
+    uint32_t id;
+    uint8_t data[8];
+};
+
+class CanTxRing {
+    private:
+        CanTxFrame frames[CAN_TX_RING_SIZE];
+        CanTxFrame urgentFrames[CAN_TX_URGENT_SIZE];
+        uint8_t head = 0;  // next frame to send
+        uint8_t count = 0;
+        uint8_t urgentHead = 0;
+        uint8_t urgentCount = 0;
+        uint8_t highWater = 0;
+        uint32_t dropped = 0;
+
+        // Removes the oldest urgent message that a later one, or the message being added, replaces -
+        // false if there is none
+        bool dropReplaced(uint32_t id, const uint8_t data[8]);
+
+    public:
+        // Adds a message to the back of its ring
+        // When the ring is full a normal message is dropped. A full urgent ring drops its oldest
+        // message that a newer one of the same kind (ID, type and octave byte) replaces, as a key frame
+        // holds the whole octave. A message with nothing newer behind it, such as the release of the
+        // octave a board has just left, is never dropped for a later one - if every waiting message is
+        // the last of its kind, the new one is dropped instead. Returns false if a message was dropped
+        bool push(uint32_t id, const uint8_t data[8], bool urgent = false);
+
+        // Takes the next message, urgent ones first - false if both rings are empty
+        bool pop(CanTxFrame& frame);
+
+        // Messages waiting in both rings
+        uint8_t getLevel() const;
+
+        // Most messages waiting at once since startup
+        uint8_t getHighWater() const;
+
+        // Messages dropped because a ring was full
+        uint32_t getDropped() const;
+};
+
+#endif
@@ -2,15 +2,24 @@
 #include <stm32l4xx_hal_rcc.h>
 #include <stm32l4xx_hal_gpio.h>
 #include <stm32l4xx_hal_cortex.h>
+#include <STM32FreeRTOS.h>
+#include <CanTxRing.h>
 
 //Overwrite the weak default IRQ Handlers and callabcks
 extern "C" void CAN1_RX0_IRQHandler(void);
+extern "C" void CAN1_RX1_IRQHandler(void);
 extern "C" void CAN1_TX_IRQHandler(void);
 
 //Pointer to user ISRS
-void (*CAN_RX_ISR)() = NULL;
+void (*CAN_RX_ISR[2])() = {NULL, NULL};
 void (*CAN_TX_ISR)() = NULL;
 
+//Receive FIFO overruns, counted in the error callback
+volatile uint32_t CAN_Overruns[2] = {0, 0};
+
+//Messages waiting for a transmit mailbox - only used by CAN_TX, with the TX interrupt masked, or from the TX interrupt
+CanTxRing CAN_TxRing;
+
 //CAN handle struct with initialisation parameters
 //Timing from http://www.bittiming.can-wiki.info/ with bit rate = 125kHz and clock frequency = 80MHz
 CAN_HandleTypeDef CAN_Handle = {
@@ -26,7 +35,7 @@ CAN_HandleTypeDef CAN_Handle = {
         ENABLE,       //AutoWakeUp
         ENABLE,       //AutoRetransmission
         DISABLE,      //ReceiveFifoLocked
-        ENABLE        //TransmitFifoPriority
+        DISABLE       //TransmitFifoPriority - off, pending mailboxes go out lowest ID first
     },
     HAL_CAN_STATE_RESET,  //State
     HAL_CAN_ERROR_NONE    //Error Code
@@ -70,7 +79,7 @@ uint32_t CAN_Init(bool loopback=false) {
 }
 
 
-uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank) {
+uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank, uint32_t fifo) {
 
   //Set up the filter definition
   CAN_FilterTypeDef filterInfo = {
@@ -78,7 +87,7 @@ uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank) {
     0,                          //Filter ID LSBs = 0
     (maskID << 5) & 0xffe0,     //Mask MSBs
     0,                          //Mask LSBs = 0
-    0,                          //FIFO selection
+    fifo & 0x1,                 //FIFO selection
     filterBank & 0xf,           //Filter bank selection
     CAN_FILTERMODE_IDMASK,      //Mask mode
     CAN_FILTERSCALE_32BIT,      //32 bit IDs
@@ -91,43 +100,85 @@ uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank) {
 
 
 uint32_t CAN_Start() {
-  return (uint32_t) HAL_CAN_Start(&CAN_Handle);
+  uint32_t status = (uint32_t) HAL_CAN_Start(&CAN_Handle);
+
+  //Enable the mailbox empty interrupt, which sends the messages waiting in the transmit ring
+  HAL_CAN_ActivateNotification (&CAN_Handle, CAN_IT_TX_MAILBOX_EMPTY);
+  HAL_NVIC_SetPriority (CAN1_TX_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ (CAN1_TX_IRQn);
+
+  return status;
 }
 
 
-uint32_t CAN_TX(uint32_t ID, uint8_t data[8]) {
+//Move waiting messages into the free mailboxes - called with the TX interrupt masked or from it
+static void CAN_FillMailboxes() {
+  CanTxFrame frame;
+  while (HAL_CAN_GetTxMailboxesFreeLevel(&CAN_Handle) && CAN_TxRing.pop(frame)) {
 
-  //Set up the message header
-  CAN_TxHeaderTypeDef txHeader = {
-    ID & 0x7ff,                 //Standard ID
-    0,                          //Ext ID = 0
-    CAN_ID_STD,                 //Use Standard ID
-    CAN_RTR_DATA,               //Data Frame
-    8,                          //Send 8 bytes
-    DISABLE                     //No time triggered mode
-  };
+    //Set up the message header
+    CAN_TxHeaderTypeDef txHeader = {
+      frame.id & 0x7ff,           //Standard ID
+      0,                          //Ext ID = 0
+      CAN_ID_STD,                 //Use Standard ID
+      CAN_RTR_DATA,               //Data Frame
+      8,                          //Send 8 bytes
+      DISABLE                     //No time triggered mode
+    };
+
+    //Start the transmission
+    uint32_t mailbox;
+    HAL_CAN_AddTxMessage(&CAN_Handle, &txHeader, frame.data, &mailbox);
+  }
+}
+
+
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8], bool urgent) {
 
-  //Wait for free mailbox
-  while (!HAL_CAN_GetTxMailboxesFreeLevel(&CAN_Handle));
+  //Only the TX interrupt and other tasks use the ring and mailboxes, so only they are held off -
+  //the sample interrupt and the receive interrupts keep running. Not for use from an ISR
+  vTaskSuspendAll();
+  HAL_NVIC_DisableIRQ(CAN1_TX_IRQn);
 
-  //Start the transmission
-  return (uint32_t) HAL_CAN_AddTxMessage(&CAN_Handle, &txHeader, data, NULL);
+  //Queue the message, then send straight away if a mailbox is free
+  bool queued = CAN_TxRing.push(ID, data, urgent);
+  CAN_FillMailboxes();
+
+  HAL_NVIC_EnableIRQ(CAN1_TX_IRQn);
+  xTaskResumeAll();
+  return queued ? 0 : 1;
+}
+
+
+uint32_t CAN_GetTxLevel() {
+  return CAN_TxRing.getLevel();
+}
+
+
+uint32_t CAN_GetTxHighWater() {
+  return CAN_TxRing.getHighWater();
 }
 
 
-uint32_t CAN_CheckRXLevel() {
-  return HAL_CAN_GetRxFifoFillLevel(&CAN_Handle, 0);
+uint32_t CAN_GetTxDropped() {
+  return CAN_TxRing.getDropped();
 }
 
 
-uint32_t CAN_RX(uint32_t &ID, uint8_t data[8]) {
+uint32_t CAN_CheckRXLevel(uint32_t fifo) {
+  return HAL_CAN_GetRxFifoFillLevel(&CAN_Handle, fifo & 0x1);
+}
+
+
+uint32_t CAN_RX(uint32_t &ID, uint8_t data[8], uint32_t fifo) {
   CAN_RxHeaderTypeDef rxHeader;
 
-  //Wait for message in FIFO
-  while (!HAL_CAN_GetRxFifoFillLevel(&CAN_Handle, 0));
-  
+  //Nothing to wait for - the RX ISRs only call this while the FIFO holds a message
+  if (!HAL_CAN_GetRxFifoFillLevel(&CAN_Handle, fifo & 0x1))
+    return HAL_ERROR;
+
   //Get the message from the FIFO
-  uint32_t result = (uint32_t) HAL_CAN_GetRxMessage(&CAN_Handle, 0, &rxHeader, data);
+  uint32_t result = (uint32_t) HAL_CAN_GetRxMessage(&CAN_Handle, fifo & 0x1, &rxHeader, data);
 
   //Store the ID from the header
   ID = rxHeader.StdId;
@@ -136,46 +187,68 @@ uint32_t CAN_RX(uint32_t &ID, uint8_t data[8]) {
 }
 
 
-uint32_t CAN_RegisterRX_ISR(void(& callback)()) {
+uint32_t CAN_RegisterRX_ISR(void(& callback)(), uint32_t fifo) {
   //Store pointer to user ISR
-  CAN_RX_ISR = &callback;
+  CAN_RX_ISR[fifo & 0x1] = &callback;
 
-  //Enable message received interrupt in HAL
-  uint32_t status = (uint32_t) HAL_CAN_ActivateNotification (&CAN_Handle, CAN_IT_RX_FIFO0_MSG_PENDING);
+  //Enable message received and FIFO overrun interrupts in HAL - both use the FIFO's interrupt line
+  uint32_t status = (uint32_t) HAL_CAN_ActivateNotification (&CAN_Handle, (fifo & 0x1) ?
+    (CAN_IT_RX_FIFO1_MSG_PENDING | CAN_IT_RX_FIFO1_OVERRUN) : (CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO0_OVERRUN));
 
   //Switch on the interrupt
-  HAL_NVIC_SetPriority (CAN1_RX0_IRQn, 6, 0);
-  HAL_NVIC_EnableIRQ (CAN1_RX0_IRQn);
+  IRQn_Type irq = (fifo & 0x1) ? CAN1_RX1_IRQn : CAN1_RX0_IRQn;
+  HAL_NVIC_SetPriority (irq, 6, 0);
+  HAL_NVIC_EnableIRQ (irq);
 
   return status;
 }
 
 
+uint32_t CAN_GetOverruns(uint32_t fifo) {
+  return CAN_Overruns[fifo & 0x1];
+}
+
+
 uint32_t CAN_RegisterTX_ISR(void(& callback)()) {
-  //Store pointer to user ISR
+  //Store pointer to user ISR - the interrupt itself is enabled by CAN_Start
   CAN_TX_ISR = &callback;
 
-  //Enable message received interrupt in HAL
-  uint32_t status = (uint32_t) HAL_CAN_ActivateNotification (&CAN_Handle, CAN_IT_TX_MAILBOX_EMPTY);
+  return 0;
+}
 
-  //Switch on the interrupt
-  HAL_NVIC_SetPriority (CAN1_TX_IRQn, 6, 0);
-  HAL_NVIC_EnableIRQ (CAN1_TX_IRQn);
 
-  return status;
+void HAL_CAN_RxFifo0MsgPendingCallback (CAN_HandleTypeDef * hcan){
+
+  //Call the user ISR if it has been registered
+  if (CAN_RX_ISR[0])
+    CAN_RX_ISR[0]();
 }
 
 
-void HAL_CAN_RxFifo0MsgPendingCallback (CAN_HandleTypeDef * hcan){
+void HAL_CAN_RxFifo1MsgPendingCallback (CAN_HandleTypeDef * hcan){
 
   //Call the user ISR if it has been registered
-  if (CAN_RX_ISR)
-    CAN_RX_ISR();
+  if (CAN_RX_ISR[1])
+    CAN_RX_ISR[1]();
+}
+
+
+void HAL_CAN_ErrorCallback (CAN_HandleTypeDef * hcan){
+
+  //Count receive FIFO overruns - the HAL has already cleared the overrun flag
+  if (hcan->ErrorCode & HAL_CAN_ERROR_RX_FOV0)
+    CAN_Overruns[0]++;
+  if (hcan->ErrorCode & HAL_CAN_ERROR_RX_FOV1)
+    CAN_Overruns[1]++;
+  HAL_CAN_ResetError(hcan);
 }
 
 
 void HAL_CAN_TxMailbox0CompleteCallback (CAN_HandleTypeDef * hcan){
 
+  //Refill the mailbox from the transmit ring
+  CAN_FillMailboxes();
+
   //Call the user ISR if it has been registered
   if (CAN_TX_ISR)
     CAN_TX_ISR();
@@ -184,6 +257,9 @@ void HAL_CAN_TxMailbox0CompleteCallback (CAN_HandleTypeDef * hcan){
 
 void HAL_CAN_TxMailbox1CompleteCallback (CAN_HandleTypeDef * hcan){
 
+  //Refill the mailbox from the transmit ring
+  CAN_FillMailboxes();
+
   //Call the user ISR if it has been registered
   if (CAN_TX_ISR)
     CAN_TX_ISR();
@@ -192,6 +268,9 @@ void HAL_CAN_TxMailbox1CompleteCallback (CAN_HandleTypeDef * hcan){
 
 void HAL_CAN_TxMailbox2CompleteCallback (CAN_HandleTypeDef * hcan){
 
+  //Refill the mailbox from the transmit ring
+  CAN_FillMailboxes();
+
   //Call the user ISR if it has been registered
   if (CAN_TX_ISR)
     CAN_TX_ISR();
@@ -206,6 +285,14 @@ void CAN1_RX0_IRQHandler(void){
 }
 
 
+//This is the base ISR at the interrupt vector
+void CAN1_RX1_IRQHandler(void){
+
+  //Use the HAL interrupt handler
+  HAL_CAN_IRQHandler(&CAN_Handle);
+}
+
+
 //This is the base ISR at the interrupt vector
 void CAN1_TX_IRQHandler(void){
 
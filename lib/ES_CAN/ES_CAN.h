@@ -1,3 +1,6 @@
+#ifndef ES_CAN_H
+#define ES_CAN_H
+
 #include <stm32l4xx_hal_cortex.h>
 
 //Initialise the CAN module
@@ -7,20 +10,36 @@ uint32_t CAN_Init(bool loopback=false);
 uint32_t CAN_Start();
 
 //Set up a recevie filter
-//Defaults to receive everything
-uint32_t setCANFilter(uint32_t filterID=0, uint32_t maskID=0, uint32_t filterBank=0);
+//Defaults to receive everything into FIFO 0
+//When several banks match a message, the lowest bank number decides the FIFO
+uint32_t setCANFilter(uint32_t filterID=0, uint32_t maskID=0, uint32_t filterBank=0, uint32_t fifo=0);
 
 //Send a message
-uint32_t CAN_TX(uint32_t ID, uint8_t data[8]);
+//Queues the message in the transmit ring (CanTxRing.h) and returns at once - the mailbox empty
+//interrupt sends it. Urgent messages are sent before any others waiting
+//Returns non-zero if a message had to be dropped because the ring was full. Call from tasks only
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8], bool urgent=false);
+
+//Get the number of messages waiting to be sent, the most that have waited at once, and the number dropped
+uint32_t CAN_GetTxLevel();
+uint32_t CAN_GetTxHighWater();
+uint32_t CAN_GetTxDropped();
 
-//Get the number of received messages
-uint32_t CAN_CheckRXLevel();
+//Get the number of received messages in a FIFO
+uint32_t CAN_CheckRXLevel(uint32_t fifo=0);
 
-//Get a received message from the FIFO
-uint32_t CAN_RX(uint32_t &ID, uint8_t data[8]);
+//Get a received message from a FIFO - returns non-zero at once if the FIFO is empty
+uint32_t CAN_RX(uint32_t &ID, uint8_t data[8], uint32_t fifo=0);
 
-//Set up an interrupt on received messages
-uint32_t CAN_RegisterRX_ISR(void(& callback)());
+//Set up an interrupt on received messages in a FIFO
+//Also counts FIFO overruns from then on
+uint32_t CAN_RegisterRX_ISR(void(& callback)(), uint32_t fifo=0);
+
+//Get the number of overruns of a FIFO - each lost at least one message
+uint32_t CAN_GetOverruns(uint32_t fifo=0);
 
 //Set up an interrupt on transmitted messages
-uint32_t CAN_RegisterTX_ISR(void(& callback)());
\ No newline at end of file
+//Called after the transmit ring has refilled the free mailbox
+uint32_t CAN_RegisterTX_ISR(void(& callback)());
+
+#endif
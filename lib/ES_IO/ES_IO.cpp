@@ -21,7 +21,29 @@ void setPinDirections() {
     pinMode(LED_BUILTIN, OUTPUT);
 }
 
-void initOutMuxBits() {
+KeyMatrix::KeyMatrix() { mutex = xSemaphoreCreateMutex(); }
+
+void KeyMatrix::begin() {
+    const int addressPins[3] = {RA0_PIN, RA1_PIN, RA2_PIN};
+    const int colPins[4] = {C0_PIN, C1_PIN, C2_PIN, C3_PIN};
+    rowPort = digitalPinToPort(RA0_PIN); // port B on the Nucleo-L432KC, as are RA1, RA2 and OUT
+    enablePort = digitalPinToPort(REN_PIN);
+    colPort = digitalPinToPort(C0_PIN);  // port A, as are C1-C3
+    enableMask = digitalPinToBitMask(REN_PIN);
+    for (int i = 0; i < 4; i++) { colMasks[i] = digitalPinToBitMask(colPins[i]); }
+
+    uint32_t outMask = digitalPinToBitMask(OUT_PIN);
+    for (uint8_t row = 0; row < 8; row++) {
+        uint32_t set = 0;
+        uint32_t reset = 0;
+        for (int i = 0; i < 3; i++) {
+            if (row >> i & 1) { set |= digitalPinToBitMask(addressPins[i]); }
+            else { reset |= digitalPinToBitMask(addressPins[i]); }
+        }
+        rowSelect[row][0] = set | (reset | outMask) << 16;
+        rowSelect[row][1] = set | outMask | reset << 16;
+    }
+
     setOutMuxBit(DRST_BIT, LOW);  //Assert display logic reset
     delayMicroseconds(2);
     setOutMuxBit(DRST_BIT, HIGH); //Release display logic reset
@@ -30,43 +52,69 @@ void initOutMuxBits() {
     setOutMuxBit(HKOE_BIT, HIGH);
 }
 
-void setRow(uint8_t rowIdx) {
+#ifndef IO_DIGITALWRITE
+void KeyMatrix::setRow(uint8_t rowIdx) {
+    enablePort->BSRR = enableMask << 16;
+    rowPort->BSRR = rowSelect[rowIdx][outBits >> rowIdx & 1];
+}
+
+std::bitset<4> KeyMatrix::readCols() {
+    enablePort->BSRR = enableMask;
+    delayMicroseconds(KEY_SETTLE_US);
+    uint32_t idr = colPort->IDR;
+    enablePort->BSRR = enableMask << 16;
+    return ((idr & colMasks[0]) ? 0x1 : 0) | ((idr & colMasks[1]) ? 0x2 : 0) |
+           ((idr & colMasks[2]) ? 0x4 : 0) | ((idr & colMasks[3]) ? 0x8 : 0);
+}
+
+#else
+void KeyMatrix::setRow(uint8_t rowIdx) {
     digitalWrite(REN_PIN, LOW);
     digitalWrite(RA0_PIN, rowIdx & 0x1);
     digitalWrite(RA1_PIN, rowIdx & 0x2);
     digitalWrite(RA2_PIN, rowIdx & 0x4);
+    digitalWrite(OUT_PIN, outBits >> rowIdx & 1);
 }
 
-std::bitset<4> readCols() {
-	std::bitset<4> result;
+std::bitset<4> KeyMatrix::readCols() {
+    std::bitset<4> result;
+    digitalWrite(REN_PIN, HIGH);
+    delayMicroseconds(KEY_SETTLE_US);
     result[0] = digitalRead(C0_PIN);
-	result[1] = digitalRead(C1_PIN);
-	result[2] = digitalRead(C2_PIN);
-	result[3] = digitalRead(C3_PIN);
+    result[1] = digitalRead(C1_PIN);
+    result[2] = digitalRead(C2_PIN);
+    result[3] = digitalRead(C3_PIN);
     digitalWrite(REN_PIN, LOW);
-	return result;
+    return result;
 }
+#endif
 
-bool readKey(uint8_t rowdx, uint8_t colIdx, uint8_t muxBit) {
-    bool result;
-    uint8_t colPin = (colIdx%2) ? ((colIdx/2) ? C3_PIN : C1_PIN) :
-                                  ((colIdx/2) ? C2_PIN : C0_PIN);
-    setRow(rowdx);
-    setOutMuxBit(rowdx, muxBit);
-    digitalWrite(REN_PIN, HIGH);
-    delayMicroseconds(3);
-    result = digitalRead(colPin);
-    digitalWrite(REN_PIN, LOW);
+std::bitset<28> KeyMatrix::scan() {
+    uint32_t inputs = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (uint8_t i = 6; i != UINT8_MAX; i--) {
+        setRow(i);
+        inputs = (inputs << 4) | readCols().to_ulong();
+    }
+    xSemaphoreGive(mutex);
+    return std::bitset<28>(inputs);
+}
+
+bool KeyMatrix::readKey(uint8_t rowIdx, uint8_t colIdx, uint8_t muxBit) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (muxBit) { outBits |= 1 << rowIdx; }
+    else { outBits &= ~(1 << rowIdx); }
+    setRow(rowIdx);
+    bool result = readCols()[colIdx];
+    xSemaphoreGive(mutex);
     return result;
 }
 
-void setOutMuxBit(const uint8_t bitIdx, const bool value) {
-    digitalWrite(REN_PIN,LOW);
-    digitalWrite(RA0_PIN, bitIdx & 0x01);
-    digitalWrite(RA1_PIN, bitIdx & 0x02);
-    digitalWrite(RA2_PIN, bitIdx & 0x04);
-    digitalWrite(OUT_PIN,value);
-    digitalWrite(REN_PIN,HIGH);
-    delayMicroseconds(2);
-    digitalWrite(REN_PIN,LOW);
+void KeyMatrix::setOutMuxBit(uint8_t bitIdx, bool value) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (value) { outBits |= 1 << bitIdx; }
+    else { outBits &= ~(1 << bitIdx); }
+    setRow(bitIdx);
+    readCols(); // enabling the row latches its output bit
+    xSemaphoreGive(mutex);
 }
\ No newline at end of file
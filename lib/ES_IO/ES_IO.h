@@ -2,24 +2,52 @@
 #define ES_IO_H
 
 #include <Arduino.h>
+#include <STM32FreeRTOS.h>
 #include <bitset>
 
 //Set Pin Directions
 void setPinDirections();
 
-//Initialise Display & Handshake bits
-void initOutMuxBits();
-
-//Sets Demux Row for reading from Key Matrix
-void setRow(uint8_t rowIdx);
-
-//Reads Column Keys for selected row in Key Matrix
-std::bitset<4> readCols();
-
-//Reads the state of a key in the key matrix
-bool readKey(uint8_t rowdx, uint8_t colIdx, uint8_t muxBit = HIGH);
-
-//Function to set outputs using key matrix
-void setOutMuxBit(const uint8_t bitIdx, const bool value);
-
-#endif
\ No newline at end of file
+// Key matrix and output mux
+// RA0-RA2 and OUT share a port, so a row's address and output bit are set with one store to the
+// port's bit set/reset register (BSRR), and all four columns come from one read of their port's input
+// data register (IDR). The masks come from the core's pin map in begin(). On the host the port
+// registers are stand-ins that pass each bit to the simulated board's pins (host/stubs), so the same
+// code runs in the simulator. Add -D IO_DIGITALWRITE to build_flags in platformio.ini to go back to
+// digitalWrite and digitalRead for comparison with PROFILE_TASKS.
+// The scan, the handshake, the knobs and the connection checks use the mux from different tasks, so
+// each access holds a mutex for the few microseconds it takes.
+class KeyMatrix {
+    private:
+        GPIO_TypeDef* rowPort = nullptr;    // RA0-RA2 and OUT
+        GPIO_TypeDef* enablePort = nullptr; // REN
+        GPIO_TypeDef* colPort = nullptr;    // C0-C3
+        uint32_t rowSelect[8][2];           // BSRR words for each row, with OUT low and high
+        uint32_t enableMask = 0;
+        uint32_t colMasks[4];
+        uint8_t outBits = 0;                // output mux bits, latched again whenever their row is enabled
+        SemaphoreHandle_t mutex;
+
+        //Disables the mux, then sets the address of a row and its output bit
+        void setRow(uint8_t rowIdx);
+
+        //Enables the selected row, waits KEY_SETTLE_US and reads its columns
+        std::bitset<4> readCols();
+
+    public:
+        KeyMatrix();
+
+        //Builds the port masks and sets the display and handshake output bits - call after setPinDirections
+        void begin();
+
+        //Reads all 7 rows, row 0 in bits 0-3
+        std::bitset<28> scan();
+
+        //Reads the state of a key in the key matrix, setting its row's output bit on the way
+        bool readKey(uint8_t rowIdx, uint8_t colIdx, uint8_t muxBit = HIGH);
+
+        //Sets one of the mux outputs (display enable and reset, handshake outputs)
+        void setOutMuxBit(uint8_t bitIdx, bool value);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include <Envelope.h>
+
+const uint16_t ENVELOPE_MAX = 32767;
+
+//Level change per block to cover full scale in timeMs
+constexpr uint16_t envelopeRate(uint32_t timeMs) {
+    uint32_t blocks = timeMs * SAMPLE_RATE / (1000 * SAMPLE_BUFFER_SIZE);
+    return (blocks <= 1) ? ENVELOPE_MAX : ENVELOPE_MAX / blocks;
+}
+
+EnvelopeRates envelopeRates(uint8_t setting) {
+    setting = std::min(setting, (uint8_t)(ENVELOPE_SETTINGS - 1));
+    return {
+        envelopeRate(ENVELOPE_TIMES_MS[setting]),
+        envelopeRate(DECAY_TIME_MS),
+        SUSTAIN_LEVEL,
+        envelopeRate(ENVELOPE_TIMES_MS[setting])
+    };
+}
+
+void Envelope::noteOn() {
+    stage = ENV_ATTACK;
+}
+
+void Envelope::noteOff() {
+    if (stage != ENV_IDLE) { stage = ENV_RELEASE; }
+}
+
+bool Envelope::isIdle() const {
+    return stage == ENV_IDLE;
+}
+
+uint16_t Envelope::getLevel() const {
+    return level;
+}
+
+uint16_t Envelope::advance(const EnvelopeRates& rates) {
+    switch (stage) {
+        case ENV_ATTACK:
+            if (level >= ENVELOPE_MAX - rates.attack) { level = ENVELOPE_MAX; stage = ENV_DECAY; }
+            else { level += rates.attack; }
+            break;
+        case ENV_DECAY:
+            if (level <= rates.sustain + rates.decay) { level = rates.sustain; stage = ENV_SUSTAIN; }
+            else { level -= rates.decay; }
+            break;
+        case ENV_SUSTAIN:
+            level = rates.sustain;
+            break;
+        case ENV_RELEASE:
+            if (level <= rates.release) { level = 0; stage = ENV_IDLE; }
+            else { level -= rates.release; }
+            break;
+        default:
+            level = 0;
+            break;
+    }
+    return level;
+}
@@ -0,0 +1,40 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <constants.h>
+
+enum EnvelopeStage { ENV_IDLE, ENV_ATTACK, ENV_DECAY, ENV_SUSTAIN, ENV_RELEASE };
+
+//Level changes per block (Q15 full scale = 32767) and the sustain level
+struct EnvelopeRates {
+    uint16_t attack;
+    uint16_t decay;
+    uint16_t sustain;
+    uint16_t release;
+};
+
+//Rates for a knob 0 setting - attack and release follow the knob, decay and sustain are fixed
+EnvelopeRates envelopeRates(uint8_t setting);
+
+// Linear ADSR in Q15, advanced once per block of samples
+// The renderer interpolates between the levels before and after each block
+class Envelope {
+    private:
+        EnvelopeStage stage = ENV_IDLE;
+        uint16_t level = 0;
+
+    public:
+        // Attack starts from the current level, so retriggering a sounding voice does not click
+        void noteOn();
+
+        void noteOff();
+
+        bool isIdle() const;
+
+        uint16_t getLevel() const;
+
+        // Advances one block and returns the level at the end of it
+        uint16_t advance(const EnvelopeRates& rates);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include <Filter.h>
+#include <cx_math.h>
+#include <Arduino.h>
+
+//Cutoff table - FILTER_CUTOFFS log spaced frequencies from FILTER_MIN_HZ to FILTER_MAX_HZ
+struct CutoffTable {
+    int32_t frequency[FILTER_CUTOFFS];
+};
+
+constexpr CutoffTable constructCutoffTable() {
+    CutoffTable table = {};
+    for (int i = 0; i < FILTER_CUTOFFS; i++) {
+        double hz = FILTER_MIN_HZ * cx::pow(FILTER_MAX_HZ / FILTER_MIN_HZ, i / (double)(FILTER_CUTOFFS - 1));
+        table.frequency[i] = (int32_t)(2 * cx::sin(PI * hz / SAMPLE_RATE) * 32768 + 0.5);
+    }
+    return table;
+}
+
+constexpr CutoffTable cutoffTable = constructCutoffTable();
+
+uint8_t filterCutoffIndex(uint8_t setting, int32_t joyXInput) {
+    int32_t index = setting * (FILTER_CUTOFFS / CUTOFF_SETTINGS) + (joyXInput - 512) / 16; // joystick sweeps +/- 32 steps
+    return std::min(std::max(index, (int32_t)0), (int32_t)(FILTER_CUTOFFS - 1));
+}
+
+void StateVariableFilter::configure(FilterMode newMode, uint8_t cutoffIndex) {
+    if (newMode == mode && cutoffIndex == cutoff) { return; }
+    if (mode == FILTER_OFF) { low = 0; band = 0; } // no stale state from the last time it was on
+    mode = newMode;
+    cutoff = cutoffIndex;
+    frequency = cutoffTable.frequency[std::min(cutoffIndex, (uint8_t)(FILTER_CUTOFFS - 1))];
+}
+
+void StateVariableFilter::process(int32_t* samples, uint32_t count) {
+    if (mode == FILTER_OFF) { return; }
+    for (uint32_t n = 0; n < count; n++) {
+        // 64 bit products - resonance lets the integrators swing past 16 bits
+        // The state keeps 8 fraction bits, or truncation leaves low cutoffs stuck short of zero
+        int32_t input = samples[n] << 8;
+        low += ((int64_t)frequency * band) >> 15;
+        int32_t high = input - low - (((int64_t)FILTER_DAMPING * band) >> 15);
+        band += ((int64_t)frequency * high) >> 15;
+
+        if (mode == FILTER_LOW) { samples[n] = low >> 8; }
+        else if (mode == FILTER_BAND) { samples[n] = band >> 8; }
+        else { samples[n] = high >> 8; }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <constants.h>
+
+enum FilterMode { FILTER_OFF, FILTER_LOW, FILTER_BAND, FILTER_HIGH };
+
+//Cutoff table index for a knob 0 setting and a joystick X reading (10 bit)
+uint8_t filterCutoffIndex(uint8_t setting, int32_t joyXInput);
+
+// Chamberlin state-variable filter in Q15, run over the mix once per block
+// Low, band and high-pass outputs come from the same two integrators, so changing mode is free
+class StateVariableFilter {
+    private:
+        FilterMode mode = FILTER_OFF;
+        uint8_t cutoff = UINT8_MAX;
+        int32_t frequency = 0; // Q15 - 2 sin(pi fc / fs)
+        int32_t low = 0;
+        int32_t band = 0;
+
+    public:
+        // Looks up coefficients only when the mode or cutoff index has changed
+        void configure(FilterMode newMode, uint8_t cutoffIndex);
+
+        // Filters samples in place - input is the signed mix before the output offset
+        void process(int32_t* samples, uint32_t count);
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include <KeyDebounce.h>
+
+void KeyDebounce::reset(std::bitset<28> sample) {
+    state = sample.to_ulong();
+    count0 = 0;
+    count1 = 0;
+}
+
+std::bitset<28> KeyDebounce::update(std::bitset<28> sample) {
+    uint32_t delta = sample.to_ulong() ^ state; // inputs that disagree with their state
+    count1 = (count1 ^ count0) & delta;         // counts 1, 2, 3, then wraps to 0 on the 4th sample
+    count0 = ~count0 & delta;
+    uint32_t toggle = delta & ~(count0 | count1);
+    state ^= toggle;
+    return std::bitset<28>(toggle);
+}
+
+std::bitset<28> KeyDebounce::getState() const {
+    return std::bitset<28>(state);
+}
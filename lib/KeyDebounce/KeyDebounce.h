@@ -0,0 +1,30 @@
+#ifndef KEYDEBOUNCE_H
+#define KEYDEBOUNCE_H
+
+#include <Arduino.h>
+#include <bitset>
+
+// Key debouncing - all 28 key matrix inputs at once, with vertical counters
+// Each input has a 2-bit counter, stored as bit n of count0 and count1, that counts the samples in a
+// row disagreeing with its debounced state. A sample that agrees clears it, and the fourth
+// disagreeing sample flips the state. At the 1 ms key scan an edge is taken 4 ms after the contact
+// stops bouncing, and bounces shorter than that never reach the state. A few logic operations per
+// sample cover every input, whatever changed. The counter width sets the 4 samples.
+
+class KeyDebounce {
+    private:
+        uint32_t state = 0xFFFFFFF; // active low, nothing pressed
+        uint32_t count0 = 0;
+        uint32_t count1 = 0;
+
+    public:
+        //Starts from a sample as the debounced state, with no changes pending
+        void reset(std::bitset<28> sample);
+
+        //Takes a sample and returns the inputs whose debounced state changed with it
+        std::bitset<28> update(std::bitset<28> sample);
+
+        std::bitset<28> getState() const;
+};
+
+#endif
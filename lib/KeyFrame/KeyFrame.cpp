@@ -0,0 +1,59 @@
+#include <KeyFrame.h>
+
+void packKeyFrame(uint8_t msg[8], uint8_t source, uint8_t octave, uint8_t sequence, uint16_t notes, uint16_t pressed) {
+    uint8_t first = pressed ? __builtin_ctz(pressed) + 1 : 0;
+    msg[0] = 'K';
+    msg[1] = (octave & 0x0F) | (source << 4);
+    msg[2] = sequence;
+    msg[3] = notes;
+    msg[4] = ((notes >> 8) & 0x0F) | (first << 4);
+}
+
+uint8_t keyFrameOctave(const uint8_t msg[8]) {
+    return msg[1] & 0x0F;
+}
+
+uint8_t keyFrameSource(const uint8_t msg[8]) {
+    return msg[1] >> 4;
+}
+
+uint16_t keyFrameNotes(const uint8_t msg[8]) {
+    return msg[3] | ((msg[4] & 0x0F) << 8);
+}
+
+int8_t keyFramePressed(const uint8_t msg[8]) {
+    return (msg[4] >> 4) - 1;
+}
+
+uint16_t KeyStates::unionOf(uint8_t octave) const {
+    uint16_t held = 0;
+    for (uint8_t source = 0; source < KEY_SOURCES; source++) {
+        held |= __atomic_load_n(&notes[source][octave], __ATOMIC_RELAXED);
+    }
+    return held;
+}
+
+uint16_t KeyStates::apply(const uint8_t msg[8]) {
+    uint8_t octave = keyFrameOctave(msg);
+    uint8_t source = keyFrameSource(msg);
+    if (octave >= OCTAVES || source >= KEY_SOURCES) { return 0; }
+    uint8_t behind = sequences[source] - msg[2];
+    if ((seen & (1 << source)) && behind != 0 && behind <= KEY_FRAME_STALE) {
+        __atomic_store_n(&stale, stale + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    seen |= 1 << source;
+    sequences[source] = msg[2];
+
+    uint16_t before = unionOf(octave);
+    __atomic_store_n(&notes[source][octave], keyFrameNotes(msg), __ATOMIC_RELAXED);
+    return before ^ unionOf(octave);
+}
+
+uint16_t KeyStates::getNotes(uint8_t octave) const {
+    return octave < OCTAVES ? unionOf(octave) : 0;
+}
+
+uint32_t KeyStates::getStale() const {
+    return __atomic_load_n(&stale, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,61 @@
+#ifndef KEYFRAME_H
+#define KEYFRAME_H
+
+#include <Arduino.h>
+#include <constants.h>
+
+// Key state frames - one 'K' message carries all 12 note states of an octave
+// A board sends one when any of its keys change, so a chord arrives in a single frame, and again
+// every KEYS_REFRESH_SCANS scans so a lost frame cannot leave a note stuck. Knob 2 lets two boards
+// play the same octave, so the receiver keeps the last state from each sending board and sounds the
+// union for every octave, starting and stopping the notes whose union changed.
+//   1   - bits 0-3 octave, bits 4-7 source board (keySource in globals.h)
+//   2   - sequence number, one more for every frame a board sends
+//   3   - notes 0-7 held (bit per note)
+//   4   - bits 0-3 notes 8-11 held, bits 4-7 lowest note newly pressed + 1 (0 if none)
+//   5-7 - key scan time when a note was newly pressed - only with TRACE_LATENCY
+
+//Frames up to this many sequence numbers behind the last one are out of order and ignored
+// Frames are swapped by the transmit mailboxes, or when the transmit ring drops an older frame to
+// make room, and are rarely more than 2 behind. A board that restarts its
+// count is unlikely to be ignored for more than a frame
+const uint8_t KEY_FRAME_STALE = 2;
+
+//Sending boards told apart - source ids are 0 to KEY_SOURCES - 1
+const uint8_t KEY_SOURCES = 8;
+
+void packKeyFrame(uint8_t msg[8], uint8_t source, uint8_t octave, uint8_t sequence, uint16_t notes, uint16_t pressed);
+
+uint8_t keyFrameOctave(const uint8_t msg[8]);
+
+uint8_t keyFrameSource(const uint8_t msg[8]);
+
+uint16_t keyFrameNotes(const uint8_t msg[8]);
+
+//Lowest note newly pressed in the frame, -1 if none - the press the latency trace follows
+int8_t keyFramePressed(const uint8_t msg[8]);
+
+// Last note state received from each sending board and octave - receiver side, used by one task
+// Sequence numbers are per sending board, so frames from two boards on one octave never look stale
+class KeyStates {
+    private:
+        uint16_t notes[KEY_SOURCES][OCTAVES] = {{0}};
+        uint8_t sequences[KEY_SOURCES] = {0};
+        uint8_t seen = 0; // bit per source
+        uint32_t stale = 0;
+
+        uint16_t unionOf(uint8_t octave) const;
+
+    public:
+        // Takes a frame and returns the notes of its octave whose union of all boards changed, 0 for an
+        // out of order frame
+        uint16_t apply(const uint8_t msg[8]);
+
+        // Notes held in an octave on any board
+        uint16_t getNotes(uint8_t octave) const;
+
+        // Frames ignored as out of order
+        uint32_t getStale() const;
+};
+
+#endif
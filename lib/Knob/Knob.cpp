@@ -1,14 +1,11 @@
 #include <Knob.h>
-#include <ES_IO.h>
 
 Knob::Knob() { mutex = xSemaphoreCreateMutex(); }
 
-void Knob::init(uint8_t knobNumber) {
+void Knob::init(bool A, bool B) {
     std::bitset<2> AB;
-    uint8_t row = 4 - (knobNumber / 2);
-    uint8_t col = 2 * (1 - (knobNumber % 2));
-    AB[1] = readKey(row,col);
-    AB[0] = readKey(row,col+1);
+    AB[1] = A;
+    AB[0] = B;
     xSemaphoreTake(mutex, portMAX_DELAY);
     currentAB = AB;
     loaded = true;
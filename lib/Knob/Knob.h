@@ -18,7 +18,8 @@ class Knob {
     public:
         Knob();
 
-        void init(uint8_t knobNumber);
+        // Starts counting turns from the current state of the A and B inputs
+        void init(bool A, bool B);
 
         bool isLoaded() const;
 
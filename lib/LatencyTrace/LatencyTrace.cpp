@@ -0,0 +1,112 @@
+#include <LatencyTrace.h>
+#include <algorithm>
+
+const char* const HOP_NAMES[TRACE_HOPS] = {"transmit", "CAN_RX_KEYS_ISR", "playNotes", "noteOn", "render"};
+
+//Differences of 24 bit times, sign extended
+static int32_t traceDiff(uint32_t a, uint32_t b) {
+    return (int32_t)(((a - b) & TRACE_TIME_MASK) << 8) >> 8;
+}
+
+void traceStamp(uint8_t msg[8], uint32_t time) {
+    msg[5] = time >> 16;
+    msg[6] = time >> 8;
+    msg[7] = time;
+}
+
+uint32_t traceStampOf(const uint8_t msg[8]) {
+    return (msg[5] << 16) | (msg[6] << 8) | msg[7];
+}
+
+uint32_t TraceClock::now() const {
+    return (micros() + __atomic_load_n(&offset,__ATOMIC_RELAXED)) & TRACE_TIME_MASK;
+}
+
+void TraceClock::sync(uint32_t stamp, uint32_t arrival) {
+    samples[sampleCount % TRACE_SYNC_WINDOW] = (stamp + TRACE_FRAME_US - arrival) & TRACE_TIME_MASK;
+    sampleCount++;
+
+    uint8_t n = std::min<uint8_t>(sampleCount, TRACE_SYNC_WINDOW);
+    uint32_t best = samples[0];
+    for (uint8_t i = 1; i < n; i++) {
+        if (traceDiff(samples[i], best) > 0) { best = samples[i]; }
+    }
+    __atomic_store_n(&offset, best, __ATOMIC_RELAXED);
+}
+
+void LatencyTrace::begin() {
+    if (samples) { return; }
+    presses = new Press[OCTAVES * 12]();
+    samples = new uint16_t[OCTAVES * TRACE_HOPS * TRACE_SAMPLES]();
+}
+
+void LatencyTrace::addSample(uint8_t octave, int hop, uint32_t latency) {
+    uint32_t n = counts[octave][hop];
+    samples[(octave * TRACE_HOPS + hop) * TRACE_SAMPLES + n % TRACE_SAMPLES] = std::min<uint32_t>(latency, UINT16_MAX);
+    __atomic_store_n(&counts[octave][hop], n + 1, __ATOMIC_RELAXED);
+}
+
+void LatencyTrace::hop(uint8_t octave, uint8_t note, TraceHop hop, uint32_t stamp, uint32_t time) {
+    if (!samples || octave >= OCTAVES || note >= 12) { return; }
+    uint32_t latency = (time - stamp) & TRACE_TIME_MASK;
+    if (hop == HOP_TRANSMIT) { // last stage on the board with the key
+        addSample(octave, hop, latency);
+        return;
+    }
+
+    Press& press = presses[octave * 12 + note];
+    if (press.stamp != stamp || !press.seen) { // a new press
+        press.stamp = stamp;
+        press.seen = 0;
+    }
+    press.hops[hop] = latency;
+    press.seen |= 1 << hop;
+    if (hop == HOP_NOTE_ON) { __atomic_fetch_or(&pendingNotes[octave], 1 << note, __ATOMIC_RELEASE); }
+}
+
+void LatencyTrace::rendered(uint32_t time) {
+    if (!samples) { return; }
+    for (uint8_t octave = 0; octave < OCTAVES; octave++) {
+        uint16_t notes = __atomic_exchange_n(&pendingNotes[octave], 0, __ATOMIC_ACQUIRE);
+        while (notes) {
+            uint8_t note = __builtin_ctz(notes);
+            notes &= notes - 1;
+            Press& press = presses[octave * 12 + note];
+            for (int hop = HOP_RX_ISR; hop < HOP_RENDER; hop++) {
+                if (press.seen & (1 << hop)) { addSample(octave, hop, press.hops[hop]); }
+            }
+            addSample(octave, HOP_RENDER, (time - press.stamp) & TRACE_TIME_MASK);
+            press.seen = 0;
+        }
+    }
+}
+
+void LatencyTrace::print() const {
+    if (!samples) { return; }
+    for (uint8_t octave = 0; octave < OCTAVES; octave++) {
+        bool any = false;
+        for (int hop = 0; hop < TRACE_HOPS; hop++) {
+            uint32_t n = __atomic_load_n(&counts[octave][hop],__ATOMIC_RELAXED);
+            if (!n) { continue; }
+            if (!any) {
+                Serial.print("Key to sound from octave ");
+                Serial.print(octave);
+                Serial.println(", us since the key scan (p50 p95 max):");
+                any = true;
+            }
+            uint16_t sorted[TRACE_SAMPLES];
+            uint32_t kept = std::min<uint32_t>(n, TRACE_SAMPLES);
+            std::copy(samples + (octave * TRACE_HOPS + hop) * TRACE_SAMPLES,
+                      samples + (octave * TRACE_HOPS + hop) * TRACE_SAMPLES + kept, sorted);
+            std::sort(sorted, sorted + kept);
+            Serial.print("  ");
+            Serial.print(HOP_NAMES[hop]);
+            Serial.print(": ");
+            Serial.print(sorted[kept / 2]);
+            Serial.print(" ");
+            Serial.print(sorted[kept * 95 / 100]);
+            Serial.print(" ");
+            Serial.println(sorted[kept - 1]);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef LATENCYTRACE_H
+#define LATENCYTRACE_H
+
+#include <Arduino.h>
+#include <constants.h>
+
+// Key-to-sound latency tracing across boards
+// Key messages carry the time the key was scanned in payload bytes 5-7, on a clock shared by all
+// boards: the receiver's micros(), which it broadcasts in sync messages. Every stage the message
+// passes records its latency from the scan, so the slowest stage shows up per source board.
+
+//Timestamps are 24 bit microseconds (wrap every 16.8 s) - latencies are differences mod 2^24
+const uint32_t TRACE_TIME_MASK = 0xFFFFFF;
+
+//Time on the bus of an 8 byte frame at 125 kbit/s, about 125 bits with stuffing
+const uint32_t TRACE_FRAME_US = 1000;
+
+//Samples kept per source board and stage for the percentiles
+const int TRACE_SAMPLES = 32;
+
+//Stages of a key press, in the order they are reached
+// TRANSMIT is recorded by the board with the key, the others by the receiver
+enum TraceHop { HOP_TRANSMIT, HOP_RX_ISR, HOP_PLAY_NOTES, HOP_NOTE_ON, HOP_RENDER, TRACE_HOPS };
+
+//Writes and reads a timestamp in bytes 5-7 of a message
+void traceStamp(uint8_t msg[8], uint32_t time);
+
+uint32_t traceStampOf(const uint8_t msg[8]);
+
+// Receiver's clock as seen by this board
+// Sync messages are stamped just before CAN_TX and arrive a frame later, or later still if the frame
+// waited for the bus, so each sync gives an offset that is at most the true one. The largest of the
+// last TRACE_SYNC_WINDOW samples is used.
+const int TRACE_SYNC_WINDOW = 4;
+const int TRACE_SYNC_SCANS = 50; // one sync a second at the 20 ms key scan tick
+
+class TraceClock {
+    private:
+        uint32_t offset = 0;
+        uint32_t samples[TRACE_SYNC_WINDOW] = {0};
+        uint8_t sampleCount = 0;
+
+    public:
+        // Shared time in microseconds, masked to 24 bits
+        uint32_t now() const;
+
+        // ISR side - a sync message stamped with the receiver's time, received at local time arrival
+        void sync(uint32_t stamp, uint32_t arrival);
+};
+
+// Stage latencies of the key presses passing through this board
+// The stages of one press are reached one after another through the message queues, so an
+// in-flight press is only ever touched by one task or ISR at a time and needs no lock. Presses are
+// complete when the renderer has run with their voice, only the renderer and the transmit task add
+// samples, each to its own stage.
+class LatencyTrace {
+    private:
+        struct Press {
+            uint32_t stamp;
+            uint32_t hops[TRACE_HOPS];
+            uint8_t seen; // bit per hop
+        };
+        Press* presses = nullptr;             // [OCTAVES][12]
+        uint16_t* samples = nullptr;          // [OCTAVES][TRACE_HOPS][TRACE_SAMPLES] microseconds
+        uint16_t pendingNotes[OCTAVES] = {0}; // note on reached, waiting for the renderer
+        uint32_t counts[OCTAVES][TRACE_HOPS] = {};
+
+        void addSample(uint8_t octave, int hop, uint32_t latency);
+
+    public:
+        // Allocates the press and sample stores - tracing does nothing until this is called
+        void begin();
+
+        // A press from octave stamped at stamp reached a stage at time
+        void hop(uint8_t octave, uint8_t note, TraceHop hop, uint32_t stamp, uint32_t time);
+
+        // Render side - completes every press whose note has started
+        void rendered(uint32_t time);
+
+        // Median, 95th percentile and maximum per source octave and stage in microseconds
+        void print() const;
+};
+
+#endif
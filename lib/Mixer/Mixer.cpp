@@ -0,0 +1,58 @@
+#include <Mixer.h>
+#include <waveforms.h>
+
+#if defined(__ARM_FEATURE_DSP) && !defined(MIXER_SCALAR)
+// CMSIS intrinsics from the core headers
+static inline uint32_t pack16(int16_t low, int16_t high) { return __PKHBT((uint16_t)low, (uint32_t)high, 16); }
+static inline uint32_t sadd16(uint32_t x, uint32_t y) { return __SADD16(x, y); }
+static inline int64_t smlald(uint32_t x, uint32_t y, int64_t acc) { return __SMLALD(x, y, acc); }
+#else
+// Portable equivalents with the same results, so the kernel can be checked off target
+static inline uint32_t pack16(int16_t low, int16_t high) { return (uint16_t)low | ((uint32_t)(uint16_t)high << 16); }
+static inline uint32_t sadd16(uint32_t x, uint32_t y) {
+    return pack16((int16_t)(x + y), (int16_t)((x >> 16) + (y >> 16)));
+}
+static inline int64_t smlald(uint32_t x, uint32_t y, int64_t acc) {
+    return acc + (int32_t)(int16_t)x * (int16_t)y + (int32_t)(int16_t)(x >> 16) * (int16_t)(y >> 16);
+}
+#endif
+
+void mixVoices(MixVoice* voices, int count, int64_t* out, uint32_t samples) {
+    int v = 0;
+    for (; v + 1 < count; v += 2) {
+        MixVoice& a = voices[v];
+        MixVoice& b = voices[v + 1];
+        const int16_t* tableA = a.wavetable;
+        const int16_t* tableB = b.wavetable;
+        uint8_t bitsA = a.tableBits;
+        uint8_t bitsB = b.tableBits;
+        uint32_t phaseA = a.phase;
+        uint32_t phaseB = b.phase;
+        uint32_t gains = pack16(a.gain, b.gain);
+        uint32_t deltas = pack16(a.gainDelta, b.gainDelta);
+
+        for (uint32_t n = 0; n < samples; n++) {
+            phaseA += a.stepSize;
+            phaseB += b.stepSize;
+            gains = sadd16(gains, deltas);
+            uint32_t waves = pack16(wavetableLookup(tableA, bitsA, phaseA), wavetableLookup(tableB, bitsB, phaseB));
+            out[n] = smlald(waves, gains, out[n]);
+        }
+
+        a.phase = phaseA;
+        b.phase = phaseB;
+    }
+    if (v < count) { mixVoicesScalar(&voices[v], 1, out, samples); } // odd voice left over
+}
+
+void mixVoicesScalar(MixVoice* voices, int count, int64_t* out, uint32_t samples) {
+    for (int v = 0; v < count; v++) {
+        MixVoice& voice = voices[v];
+        int16_t gain = voice.gain;
+        for (uint32_t n = 0; n < samples; n++) {
+            voice.phase += voice.stepSize;
+            gain = (int16_t)(gain + voice.gainDelta);
+            out[n] += (int32_t)wavetableLookup(voice.wavetable, voice.tableBits, voice.phase) * gain;
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <Arduino.h>
+
+//One voice's state for a block - the mixer advances phase in place
+struct MixVoice {
+    const int16_t* wavetable; // Q15 with a guard entry, see selectWavetable
+    uint8_t tableBits;
+    uint32_t phase;
+    uint32_t stepSize;
+    int16_t gain;      // Q15 at the start of the block
+    int16_t gainDelta; // Q15 change per sample
+};
+
+// Adds wavetable * gain (Q30 products) for every voice into out, one int64 per sample
+// Voices are mixed in pairs: both gains ramp with one packed add (SADD16), and both
+// products are accumulated with one long dual multiply-accumulate (SMLALD).
+// Uses the Cortex-M4 DSP instructions when available, unless MIXER_SCALAR is defined
+void mixVoices(MixVoice* voices, int count, int64_t* out, uint32_t samples);
+
+// Plain C reference - bit exact with mixVoices on every platform
+void mixVoicesScalar(MixVoice* voices, int count, int64_t* out, uint32_t samples);
+
+#endif
@@ -0,0 +1,70 @@
+#include <Profiler.h>
+
+#ifndef DWT
+#include <chrono>
+
+static uint32_t hostCycles() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return nanos * (F_CPU / 1000000) / 1000;
+}
+
+static uint32_t (*cycleClock)() = hostCycles;
+
+void cycleCounterInit() {}
+
+uint32_t cycleCount() {
+    return cycleClock();
+}
+
+void setCycleClock(uint32_t (*clock)()) {
+    cycleClock = clock ? clock : hostCycles;
+}
+#endif
+
+uint32_t ProfileStats::getCount() const {
+    return __atomic_load_n(&count,__ATOMIC_RELAXED);
+}
+
+uint32_t ProfileStats::getMin() const {
+    return getCount() ? __atomic_load_n(&min,__ATOMIC_RELAXED) : 0;
+}
+
+uint32_t ProfileStats::getMax() const {
+    return __atomic_load_n(&max,__ATOMIC_RELAXED);
+}
+
+uint32_t ProfileStats::getMean() const {
+    uint32_t n = getCount();
+    return n ? __atomic_load_n(&total,__ATOMIC_RELAXED) / n : 0;
+}
+
+uint32_t ProfileStats::getBucket(int bucket) const {
+    return __atomic_load_n(&buckets[bucket],__ATOMIC_RELAXED);
+}
+
+void ProfileStats::print(const char* name) const {
+    const uint32_t cyclesPerMicro = F_CPU / 1000000;
+    Serial.print(name);
+    Serial.print(": n=");
+    Serial.print(getCount());
+    Serial.print(" min=");
+    Serial.print(getMin());
+    Serial.print(" mean=");
+    Serial.print(getMean());
+    Serial.print(" max=");
+    Serial.print(getMax());
+    Serial.print(" cycles (max ");
+    Serial.print(getMax() / cyclesPerMicro);
+    Serial.println(" us)");
+
+    // "<2^b" is the upper bound of each bucket
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        uint32_t n = getBucket(b);
+        if (!n) { continue; }
+        Serial.print(b == PROFILE_BUCKETS - 1 ? "  >=2^" : "  <2^");
+        Serial.print(b == PROFILE_BUCKETS - 1 ? b - 1 : b);
+        Serial.print(": ");
+        Serial.println(n);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+
+// Execution time statistics from the Cortex-M4 DWT cycle counter (CYCCNT, one count per CPU clock)
+// Each ProfileStats has one writer - an ISR or a task - so recording takes no lock; readers may see
+// a sample half recorded, which only matters for the one line being printed.
+// Off target there is no DWT: the counter is a mock clock, host time scaled to F_CPU by default,
+// so the same code runs in the host tools and the simulator.
+
+//Histogram buckets - bucket b counts times from 2^(b-1) to 2^b - 1 cycles, the last one everything above
+const int PROFILE_BUCKETS = 24;
+
+#ifdef DWT
+//Starts the cycle counter - call once in setup()
+inline void cycleCounterInit() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+//Wraps every 2^32 cycles (53 s at 80 MHz) - take differences as uint32_t
+inline uint32_t cycleCount() {
+    return DWT->CYCCNT;
+}
+#else
+void cycleCounterInit();
+
+uint32_t cycleCount();
+
+//Replaces the mock clock, e.g. with a counter stepped by a test - nullptr goes back to host time
+void setCycleClock(uint32_t (*clock)());
+#endif
+
+class ProfileStats {
+    private:
+        uint32_t count = 0;
+        uint32_t min = UINT32_MAX;
+        uint32_t max = 0;
+        uint64_t total = 0;
+        uint32_t buckets[PROFILE_BUCKETS] = {0};
+
+    public:
+        // Adds one execution time in cycles
+        inline void record(uint32_t cycles) {
+            int bucket = cycles ? 32 - __builtin_clz(cycles) : 0;
+            if (bucket >= PROFILE_BUCKETS) { bucket = PROFILE_BUCKETS - 1; }
+            __atomic_store_n(&buckets[bucket], buckets[bucket] + 1, __ATOMIC_RELAXED);
+            if (cycles < min) { __atomic_store_n(&min, cycles, __ATOMIC_RELAXED); }
+            if (cycles > max) { __atomic_store_n(&max, cycles, __ATOMIC_RELAXED); }
+            __atomic_store_n(&total, total + cycles, __ATOMIC_RELAXED);
+            __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+        }
+
+        uint32_t getCount() const;
+
+        uint32_t getMin() const;
+
+        uint32_t getMax() const;
+
+        uint32_t getMean() const;
+
+        uint32_t getBucket(int bucket) const;
+
+        // One line of count/min/mean/max in cycles and microseconds, then the non-empty buckets
+        void print(const char* name) const;
+};
+
+#endif
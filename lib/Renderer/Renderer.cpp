@@ -0,0 +1,62 @@
+#include <Renderer.h>
+#include <waveforms.h>
+
+void Renderer::renderBlock(VoicePool& pool, const RenderControls& controls, StereoSample* block) {
+    uint8_t volume = controls.volume;
+    uint8_t waveform = controls.waveform;
+    EnvelopeRates rates = envelopeRates(controls.envelope);
+    filter.configure((FilterMode)controls.filterMode, controls.filterCutoff);
+
+    // Active voices are gathered once per block, so the mixing kernel has no branches or shifts
+    // Envelopes are advanced once per block and interpolated linearly across it
+    int voices = 0;
+    uint32_t mask = pool.getActiveMask();
+    while (mask) {
+        uint8_t i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        uint32_t thisStepSize = pool.getStepSize(i); // includes octave and bend
+
+        uint8_t flags = pool.takeFlags(i);
+        if (flags & VOICE_RESTART) {
+            // A retriggered or stolen voice attacks from its current level, so it keeps its phase
+            // rather than stepping the waveform - only a silent one starts from zero
+            if (!envelopes[i].getLevel()) { phaseAcc[i] = 0; }
+            envelopes[i].noteOn();
+        }
+        if (!(flags & VOICE_GATE)) { envelopes[i].noteOff(); }
+        if ((flags & VOICE_DONE) && !(flags & VOICE_RESTART)) { continue; } // silent until the pool reclaims it
+
+        int32_t startLevel = envelopes[i].getLevel();
+        int32_t endLevel = envelopes[i].advance(rates);
+        pool.setLevel(i, endLevel);
+        if (envelopes[i].isIdle()) { pool.finish(i); } // this block still fades to zero
+
+        slot[voices] = i;
+        Wavetable table = selectWavetable(waveform, thisStepSize); // band-limited for this pitch
+        mix[voices].wavetable = table.samples;
+        mix[voices].tableBits = table.bits;
+        mix[voices].phase = phaseAcc[i];
+        mix[voices].stepSize = thisStepSize;
+        mix[voices].gain = startLevel;
+        mix[voices].gainDelta = (endLevel - startLevel) / (int32_t)SAMPLE_BUFFER_SIZE;
+        voices++;
+    }
+
+    for (uint32_t n = 0; n < SAMPLE_BUFFER_SIZE; n++) { mixBuffer[n] = 0; }
+    mixVoices(mix, voices, mixBuffer, SAMPLE_BUFFER_SIZE);
+
+    for (uint32_t n = 0; n < SAMPLE_BUFFER_SIZE; n++) {
+        int32_t Vout = mixBuffer[n] >> 12; // Q30 (Q15 sample x Q15 gain) to 16 bit with 3 bits of gain, taken back by MIX_HEADROOM
+        Vout = Vout >> (8 - volume);
+        outBuffer[n] = Vout >> MIX_HEADROOM; // shift rather than divide by ACCUMULATORS
+    }
+
+    filter.process(outBuffer, SAMPLE_BUFFER_SIZE); // post-mix, so the cost does not grow with voices
+
+    for (uint32_t n = 0; n < SAMPLE_BUFFER_SIZE; n++) {
+        uint16_t Vout = std::min(std::max(outBuffer[n] + 32768, (int32_t)0), (int32_t)65535);
+        block[n] = {Vout, Vout}; // mono mix on both channels
+    }
+
+    for (int v = 0; v < voices; v++) { phaseAcc[slot[v]] = mix[v].phase; }
+}
@@ -0,0 +1,36 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <constants.h>
+#include <AudioOut.h>
+#include <Voices.h>
+#include <Envelope.h>
+#include <Mixer.h>
+#include <Filter.h>
+
+//Controls sampled once per block
+struct RenderControls {
+    uint8_t volume;       // 0-8
+    uint8_t waveform;     // 0-3
+    uint8_t envelope;     // knob 0 setting
+    uint8_t filterMode;   // FilterMode
+    uint8_t filterCutoff; // cutoff table index
+};
+
+// Turns the sounding voices of a pool into one block of stereo samples
+// Keeps each voice's phase and envelope between blocks, so use one renderer per output
+class Renderer {
+    private:
+        uint32_t phaseAcc[ACCUMULATORS] = {0};
+        Envelope envelopes[ACCUMULATORS];
+        uint8_t slot[ACCUMULATORS];
+        MixVoice mix[ACCUMULATORS];
+        int64_t mixBuffer[SAMPLE_BUFFER_SIZE];
+        int32_t outBuffer[SAMPLE_BUFFER_SIZE];
+        StateVariableFilter filter;
+
+    public:
+        void renderBlock(VoicePool& pool, const RenderControls& controls, StereoSample* block);
+};
+
+#endif
@@ -6,6 +6,10 @@ bool SysState::isLooping() const {
     return __atomic_load_n(&looping,__ATOMIC_RELAXED);
 }
 
+bool SysState::isKnob0Filter() const {
+    return __atomic_load_n(&knob0Filter,__ATOMIC_RELAXED);
+}
+
 bool SysState::isReceiver() const {
     return __atomic_load_n(&receiver,__ATOMIC_RELAXED);
 }
@@ -26,6 +30,18 @@ uint8_t SysState::getVolume() const {
     return __atomic_load_n(&volume,__ATOMIC_RELAXED);
 }
 
+uint8_t SysState::getEnvelope() const {
+    return __atomic_load_n(&envelope,__ATOMIC_RELAXED);
+}
+
+uint8_t SysState::getCutoff() const {
+    return __atomic_load_n(&cutoff,__ATOMIC_RELAXED);
+}
+
+uint8_t SysState::getFilterMode() const {
+    return __atomic_load_n(&filterMode,__ATOMIC_RELAXED);
+}
+
 uint8_t SysState::getConns() const {
     return __atomic_load_n(&connections,__ATOMIC_RELAXED);
 }
@@ -46,6 +62,10 @@ uint8_t SysState::getReceiverOctave() const {
     return __atomic_load_n(&receiverOctave,__ATOMIC_RELAXED);
 }
 
+uint8_t SysState::getGeneration() const {
+    return __atomic_load_n(&generation,__ATOMIC_RELAXED);
+}
+
 void SysState::setReceiver(bool rec) {
     __atomic_store_n(&receiver,rec,__ATOMIC_RELAXED);
 }
@@ -54,6 +74,10 @@ void SysState::setLooping(bool loop) {
     __atomic_store_n(&looping,loop,__ATOMIC_RELAXED);
 }
 
+void SysState::setKnob0Filter(bool filter) {
+    __atomic_store_n(&knob0Filter,filter,__ATOMIC_RELAXED);
+}
+
 void SysState::setInputs(std::bitset<28> in) {
     xSemaphoreTake(mutex, portMAX_DELAY);
     inputs = in;
@@ -68,6 +92,18 @@ void SysState::setVolume(uint8_t vol) {
     __atomic_store_n(&volume,vol,__ATOMIC_RELAXED);
 }
 
+void SysState::setEnvelope(uint8_t env) {
+    __atomic_store_n(&envelope,env,__ATOMIC_RELAXED);
+}
+
+void SysState::setCutoff(uint8_t cut) {
+    __atomic_store_n(&cutoff,cut,__ATOMIC_RELAXED);
+}
+
+void SysState::setFilterMode(uint8_t filter) {
+    __atomic_store_n(&filterMode,filter,__ATOMIC_RELAXED);
+}
+
 void SysState::setConns(uint8_t conns) {
     __atomic_store_n(&connections,conns,__ATOMIC_RELAXED);
 }
@@ -86,4 +122,97 @@ void SysState::setHighestOctave(uint8_t highOct) {
 
 void SysState::setReceiverOctave(uint8_t recOct) {
     __atomic_store_n(&receiverOctave,recOct,__ATOMIC_RELAXED);
-}
\ No newline at end of file
+}
+
+void SysState::setGeneration(uint8_t gen) {
+    __atomic_store_n(&generation,gen,__ATOMIC_RELAXED);
+}
+
+uint8_t SysState::deltaIndex(uint8_t type) {
+    switch (type) {
+        case 'V': return 0;
+        case 'W': return 1;
+        case 'E': return 2;
+        case 'C': return 3;
+        default: return 4; // 'M'
+    }
+}
+
+void SysState::recordDelta(uint8_t index, uint8_t gen, uint8_t source) {
+    deltaGenerations[index] = gen;
+    deltaSources[index] = source;
+    if ((int8_t)(gen - getGeneration()) > 0) { setGeneration(gen); } // wraps
+    for (uint8_t i = 0; i < DELTA_SETTINGS; i++) { // settings left alone for a long time keep up
+        if ((uint8_t)(getGeneration() - deltaGenerations[i]) > DELTA_WINDOW) {
+            deltaGenerations[i] = getGeneration() - DELTA_WINDOW;
+        }
+    }
+}
+
+uint8_t SysState::nextGeneration(uint8_t type, uint8_t source) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint8_t gen = getGeneration() + 1;
+    recordDelta(deltaIndex(type), gen, source);
+    xSemaphoreGive(mutex);
+    return gen;
+}
+
+bool SysState::acceptDelta(uint8_t type, uint8_t gen, uint8_t source) {
+    uint8_t i = deltaIndex(type);
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int8_t ahead = gen - deltaGenerations[i]; // wraps, the record stays within DELTA_WINDOW
+    bool wins = ahead > 0 || (ahead == 0 && source < deltaSources[i]);
+    if (wins) { recordDelta(i, gen, source); }
+    xSemaphoreGive(mutex);
+    return wins;
+}
+
+uint16_t SysState::packSettings() const {
+    uint8_t low = (getWaveform() & 0x3) | ((getFilterMode() & 0x3) << 2) | (getVolume() << 4);
+    uint8_t high = (getEnvelope() & 0xF) | (getCutoff() << 4);
+    return (high << 8) | low;
+}
+
+void SysState::packSnapshot(uint8_t msg[8]) const {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint16_t settings = packSettings();
+    msg[0] = 'A';
+    msg[1] = STATE_VERSION;
+    msg[2] = getGeneration();
+    msg[3] = settings & 0xFF;
+    msg[4] = settings >> 8;
+    msg[5] = getLowestOctave();
+    msg[6] = getHighestOctave();
+    msg[7] = getReceiverOctave();
+    xSemaphoreGive(mutex);
+}
+
+bool SysState::applySnapshot(const uint8_t msg[8], bool joining) {
+    if (msg[1] != STATE_VERSION) { return false; }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int8_t ahead = msg[2] - getGeneration(); // wraps, as generations do
+    bool newer = ahead > 0;
+    if (!newer && ahead == 0) { newer = ((msg[4] << 8) | msg[3]) > packSettings(); }
+    if (newer) {
+        setWaveform(msg[3] & 0x3);
+        setFilterMode((msg[3] >> 2) & 0x3);
+        setVolume(msg[3] >> 4);
+        setEnvelope(msg[4] & 0xF);
+        setCutoff(msg[4] >> 4);
+        setGeneration(msg[2]);
+        for (uint8_t i = 0; i < DELTA_SETTINGS; i++) { // holds every change up to its generation
+            deltaGenerations[i] = msg[2];
+            deltaSources[i] = 0; // below any board's, so deltas of the same generation do not undo it
+        }
+    }
+    if (joining) {
+        setLowestOctave(msg[5]);
+        setHighestOctave(msg[6]);
+        setReceiverOctave(msg[7]);
+    } else if (msg[7] < getReceiverOctave()) { // two stacks with a receiver each joined, the lower one stays
+        setReceiverOctave(msg[7]);
+    }
+    setReceiver(getOctave() == getReceiverOctave());
+    xSemaphoreGive(mutex);
+    return newer;
+}
@@ -3,21 +3,55 @@
 
 #include <bitset>
 #include <STM32FreeRTOS.h>
+#include <constants.h>
+
+// Stack-wide state travels as one snapshot frame ('A'), so a board that joins gets all of it at once
+// 0: 'A'
+// 1: STATE_VERSION - a board ignores snapshots of another layout
+// 2: generation - counts the settings changes made anywhere on the stack, so old ones lose
+// 3: waveform (bits 0-1), filter mode (bits 2-3), volume (bits 4-7)
+// 4: envelope (bits 0-3), cutoff (bits 4-7)
+// 5: lowest octave
+// 6: highest octave
+// 7: receiver octave
+// The version leaves room for a multi-frame layout if the state outgrows these 8 bytes
+const uint8_t STATE_VERSION = 1;
+
+// Settings a delta can change (V, W, E, C, M), each with a record of the change that last set it
+const uint8_t DELTA_SETTINGS = 5;
+// A record is kept within this many generations of the stack's, so comparing it with a delta never wraps
+const uint8_t DELTA_WINDOW = 64;
 
 class SysState {
     private:
         bool receiver = false;
         bool looping = false;
+        bool knob0Filter = false;
         std::bitset<28> inputs = 0xFFFFFFF;
         uint8_t waveform = 0;
         uint8_t volume = 0;
+        uint8_t envelope = 0;
+        uint8_t cutoff = CUTOFF_SETTINGS - 1;
+        uint8_t filterMode = 0;
         uint8_t connections = 0;
         uint8_t octave = 0;
         uint8_t lowestOctave = 0;
         uint8_t highestOctave = UINT8_MAX;
         uint8_t receiverOctave = 4;
+        uint8_t generation = 0;
+        uint8_t deltaGenerations[DELTA_SETTINGS] = {0};
+        uint8_t deltaSources[DELTA_SETTINGS] = {0};
         SemaphoreHandle_t mutex;
 
+        // Index of a V, W, E, C or M delta in the records
+        static uint8_t deltaIndex(uint8_t type);
+
+        // Records a change to a setting and raises the generation to it if it is later. Holding the mutex
+        void recordDelta(uint8_t index, uint8_t gen, uint8_t source);
+
+        // Snapshot bytes 3 (low) and 4 (high)
+        uint16_t packSettings() const;
+
     public:
         SysState();
 
@@ -25,12 +59,20 @@ class SysState {
 
         bool isLooping() const;
 
+        bool isKnob0Filter() const;
+
         std::bitset<28> getInputs() const;
 
         uint8_t getWaveform() const;
 
         uint8_t getVolume() const;
 
+        uint8_t getEnvelope() const;
+
+        uint8_t getCutoff() const;
+
+        uint8_t getFilterMode() const;
+
         uint8_t getConns() const;
 
         uint8_t getOctave() const;
@@ -41,16 +83,26 @@ class SysState {
 
         uint8_t getReceiverOctave() const;
 
+        uint8_t getGeneration() const;
+
         void setReceiver(bool rec);
         
         void setLooping(bool loop);
 
+        void setKnob0Filter(bool filter);
+
         void setInputs(std::bitset<28> in);
 
         void setWaveform(uint8_t wave);
 
         void setVolume(uint8_t vol);
 
+        void setEnvelope(uint8_t env);
+
+        void setCutoff(uint8_t cut);
+
+        void setFilterMode(uint8_t filter);
+
         void setConns(uint8_t conns);
 
         void setOctave(uint8_t oct);
@@ -60,6 +112,24 @@ class SysState {
         void setHighestOctave(uint8_t highOct);
 
         void setReceiverOctave(uint8_t recOct);
+
+        void setGeneration(uint8_t gen);
+
+        // Generation of a settings change made on this board, recorded for the setting with the board's source
+        uint8_t nextGeneration(uint8_t type, uint8_t source);
+
+        // Whether a settings delta from another board wins - a later generation than the change that last
+        // set this setting, or the same one from a lower source, so two boards changing it at once agree.
+        // Changes to other settings do not count. Records it when it does
+        bool acceptDelta(uint8_t type, uint8_t gen, uint8_t source);
+
+        void packSnapshot(uint8_t msg[8]) const;
+
+        // Takes the settings of a snapshot newer than this board's - a later generation, or the same
+        // one with larger settings bytes so two boards swapping snapshots agree - and, when joining a
+        // stack, its octave range and receiver too. Otherwise the lower of the two receiver octaves is
+        // kept, so stacks joined with a receiver each end up with one. Returns false if no settings were taken
+        bool applySnapshot(const uint8_t msg[8], bool joining);
 };
 
 #endif
\ No newline at end of file
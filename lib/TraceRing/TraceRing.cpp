@@ -0,0 +1,69 @@
+#include <TraceRing.h>
+#include <Profiler.h>
+#include <algorithm>
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "trace ring size must be a power of two");
+static_assert(sizeof(TraceRecord) == 8, "trace records are 8 bytes on the wire");
+
+//Lap of a slot index - never 0, so a zeroed record is never taken as published
+static uint8_t lapOf(uint32_t index) {
+    return (index / TRACE_RING_SIZE) % 255 + 1;
+}
+
+void TraceRing::begin() {
+    if (!records) { records = new TraceRecord[TRACE_RING_SIZE](); }
+}
+
+void TraceRing::write(uint8_t event, uint8_t a, uint8_t b) {
+    if (!records) { return; }
+    uint32_t slot = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        if (slot - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &slot, slot + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    TraceRecord& record = records[slot % TRACE_RING_SIZE];
+    record.time = cycleCount();
+    record.event = event;
+    record.a = a;
+    record.b = b;
+    __atomic_store_n(&record.lap, lapOf(slot), __ATOMIC_RELEASE);
+}
+
+uint32_t TraceRing::read(TraceRecord* out, uint32_t max) {
+    if (!records) { return 0; }
+    uint32_t next = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    uint32_t n = 0;
+    while (n < max) {
+        TraceRecord& record = records[next % TRACE_RING_SIZE];
+        if (__atomic_load_n(&record.lap, __ATOMIC_ACQUIRE) != lapOf(next)) { break; }
+        out[n++] = record;
+        next++;
+    }
+    __atomic_store_n(&tail, next, __ATOMIC_RELEASE); // frees the slots for writers
+    return n;
+}
+
+uint32_t TraceRing::takeDropped() {
+    return __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+}
+
+uint32_t TraceRing::drainToSerial() {
+    static TraceRecord batch[TRACE_BATCH + 1]; // off the drain task's small stack, there is one reader
+    uint32_t n = 0;
+    uint32_t lost = takeDropped();
+    if (lost) {
+        lost = std::min<uint32_t>(lost, UINT16_MAX);
+        batch[n++] = {cycleCount(), EVENT_DROPPED, (uint8_t)lost, (uint8_t)(lost >> 8), 0};
+    }
+    n += read(batch + n, TRACE_BATCH);
+    if (!n) { return 0; }
+
+    uint8_t count = n;
+    Serial.write(TRACE_MAGIC, 2);
+    Serial.write(&count, 1);
+    Serial.write((const uint8_t*)batch, n * sizeof(TraceRecord));
+    return n;
+}
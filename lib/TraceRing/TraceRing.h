@@ -0,0 +1,73 @@
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <Arduino.h>
+
+// Binary event trace - fixed size records in a RAM ring, written by any task or ISR and read by
+// one drain task that streams them over Serial for the host decoder (host/tools/trace_decode.cpp)
+// Writers reserve a slot with a compare-and-swap on the head, fill it and publish it by storing the
+// slot's lap number last, so there are no locks and a writer never waits. The reader stops at the
+// first slot not yet published. When the ring is full new records are dropped and counted.
+
+//Records in the ring - a power of two
+const uint32_t TRACE_RING_SIZE = 512;
+
+//Record types - a and b depend on the type
+enum TraceEvent {
+    EVENT_BEGIN,         // a = ProfileSlot, an ISR call or task loop iteration starts
+    EVENT_END,           // a = ProfileSlot
+    EVENT_QUEUE_SEND,    // a = TraceQueue, b = message type
+    EVENT_QUEUE_RECEIVE, // a = TraceQueue, b = message type
+    EVENT_CAN_TX,        // a = message type, b = byte 1 - queued in the transmit ring
+    EVENT_CAN_RX,        // a = message type, b = byte 1
+    EVENT_NOTE_ON,       // a = octave, b = note
+    EVENT_NOTE_OFF,      // a = octave, b = note
+    EVENT_UNDERRUN,      // the sample ISR found no rendered block
+    EVENT_DROPPED,       // a | b << 8 records lost to a full ring, added by the drain
+    TRACE_EVENTS_COUNT
+};
+
+enum TraceQueue { QUEUE_MSG_IN, QUEUE_NOTE_PLAYING };
+
+//8 bytes, little endian on the wire as in memory
+struct TraceRecord {
+    uint32_t time;  // cycle counter (Profiler.h)
+    uint8_t event;
+    uint8_t a;
+    uint8_t b;
+    uint8_t lap;    // publishes the record - see TraceRing::write
+};
+
+//Stream framing - TRACE_MAGIC, a record count, then that many records
+const uint8_t TRACE_MAGIC[2] = {'T', 'R'};
+const uint8_t TRACE_BATCH = 32;
+
+//Serial rate while tracing - a busy board writes about 1000 records (8 kB) a second
+const uint32_t TRACE_BAUD = 460800;
+
+class TraceRing {
+    private:
+        TraceRecord* records = nullptr;
+        uint32_t head = 0;    // next slot to reserve
+        uint32_t tail = 0;    // next slot to read
+        uint32_t dropped = 0;
+
+    public:
+        // Allocates the ring - writes are ignored until this is called
+        void begin();
+
+        // Any task or ISR
+        void write(uint8_t event, uint8_t a = 0, uint8_t b = 0);
+
+        // Drain side - copies up to max published records in order, returns how many
+        uint32_t read(TraceRecord* out, uint32_t max);
+
+        // Drain side - records dropped since the last call
+        uint32_t takeDropped();
+
+        // Drain side - reads a batch and writes it to Serial, with an EVENT_DROPPED record first if
+        // records were lost - returns the records written
+        uint32_t drainToSerial();
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include <Voices.h>
+
+VoicePool::VoicePool(VoiceSteal stealPolicy) : policy(stealPolicy) {
+    mutex = xSemaphoreCreateMutex();
+    for (uint8_t i = 0; i < ACCUMULATORS; i++) {
+        voices[i] = {};
+        freeList[freeCount++] = ACCUMULATORS - 1 - i; // voice 0 is handed out first
+    }
+    for (int oct = 0; oct < OCTAVES; oct++) {
+        for (int note = 0; note < 12; note++) { noteVoice[oct][note] = NO_VOICE; }
+    }
+}
+
+uint8_t VoicePool::steal() {
+    uint8_t victim = NO_VOICE;
+    uint32_t mask = activeMask;
+    while (mask) {
+        uint8_t i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (victim == NO_VOICE) { victim = i; continue; }
+
+        bool quieter = policy == STEAL_QUIETEST && voices[i].level < voices[victim].level;
+        bool sameLevel = policy != STEAL_QUIETEST || voices[i].level == voices[victim].level;
+        if (quieter || (sameLevel && (int32_t)(voices[i].age - voices[victim].age) < 0)) { victim = i; }
+    }
+    release(victim);
+    return freeList[--freeCount];
+}
+
+void VoicePool::release(uint8_t idx) {
+    __atomic_store_n(&activeMask, activeMask & ~(1UL << idx), __ATOMIC_RELEASE);
+    if (noteVoice[voices[idx].octave][voices[idx].note] == idx) {
+        noteVoice[voices[idx].octave][voices[idx].note] = NO_VOICE;
+    }
+    freeList[freeCount++] = idx;
+}
+
+void VoicePool::reclaim() {
+    uint32_t mask = activeMask;
+    while (mask) {
+        uint8_t i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (__atomic_load_n(&voices[i].flags, __ATOMIC_RELAXED) & VOICE_DONE) { release(i); }
+    }
+}
+
+uint8_t VoicePool::noteOn(uint8_t octave, uint8_t note, uint32_t stepSize) {
+    if (octave >= OCTAVES || note >= 12) { return NO_VOICE; }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    reclaim();
+    uint8_t idx = noteVoice[octave][note];
+    if (idx != NO_VOICE && policy != STEAL_SAME_NOTE) {
+        __atomic_fetch_and(&voices[idx].flags, (uint8_t)~VOICE_GATE, __ATOMIC_RELAXED); // repeated note gets a fresh voice, the old one rings out
+        idx = NO_VOICE;
+    }
+    if (idx == NO_VOICE) {
+        idx = freeCount ? freeList[--freeCount] : steal();
+    }
+
+    Voice& voice = voices[idx];
+    voice.note = note;
+    voice.octave = octave;
+    voice.age = nextAge++;
+    voice.level = UINT16_MAX;
+    __atomic_store_n(&voice.stepSize, stepSize, __ATOMIC_RELAXED);
+    __atomic_store_n(&voice.flags, VOICE_RESTART | VOICE_GATE, __ATOMIC_RELAXED);
+    noteVoice[octave][note] = idx;
+    __atomic_store_n(&activeMask, activeMask | (1UL << idx), __ATOMIC_RELEASE); // publish after the voice is written
+    xSemaphoreGive(mutex);
+    return idx;
+}
+
+void VoicePool::noteOff(uint8_t octave, uint8_t note) {
+    if (octave >= OCTAVES || note >= 12) { return; }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint8_t idx = noteVoice[octave][note];
+    if (idx != NO_VOICE) {
+        __atomic_fetch_and(&voices[idx].flags, (uint8_t)~VOICE_GATE, __ATOMIC_RELAXED); // envelope releases, renderer marks it done
+    }
+    reclaim();
+    xSemaphoreGive(mutex);
+}
+
+uint32_t VoicePool::getActiveMask() const {
+    return __atomic_load_n(&activeMask,__ATOMIC_ACQUIRE);
+}
+
+bool VoicePool::isHeld(uint8_t octave, uint8_t note) const {
+    if (octave >= OCTAVES || note >= 12) { return false; }
+    uint8_t idx = __atomic_load_n(&noteVoice[octave][note],__ATOMIC_RELAXED);
+    if (idx == NO_VOICE || !(getActiveMask() & (1UL << idx))) { return false; }
+    return __atomic_load_n(&voices[idx].flags,__ATOMIC_RELAXED) & VOICE_GATE;
+}
+
+uint8_t VoicePool::getNote(uint8_t idx) const {
+    return __atomic_load_n(&voices[idx].note,__ATOMIC_RELAXED);
+}
+
+uint8_t VoicePool::getOctave(uint8_t idx) const {
+    return __atomic_load_n(&voices[idx].octave,__ATOMIC_RELAXED);
+}
+
+uint32_t VoicePool::getStepSize(uint8_t idx) const {
+    return __atomic_load_n(&voices[idx].stepSize,__ATOMIC_RELAXED);
+}
+
+uint8_t VoicePool::takeFlags(uint8_t idx) {
+    return __atomic_fetch_and(&voices[idx].flags, (uint8_t)~VOICE_RESTART, __ATOMIC_RELAXED);
+}
+
+void VoicePool::finish(uint8_t idx) {
+    uint8_t flags = __atomic_load_n(&voices[idx].flags, __ATOMIC_RELAXED);
+    while (!(flags & VOICE_RESTART)) { // a restart from the pool wins
+        if (__atomic_compare_exchange_n(&voices[idx].flags, &flags, flags | VOICE_DONE, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { break; }
+    }
+}
+
+VoiceSteal VoicePool::getPolicy() const {
+    return __atomic_load_n(&policy,__ATOMIC_RELAXED);
+}
+
+void VoicePool::setStepSize(uint8_t idx, uint32_t stepSize) {
+    __atomic_store_n(&voices[idx].stepSize,stepSize,__ATOMIC_RELAXED);
+}
+
+void VoicePool::retune(uint32_t bend, uint32_t (*stepSizeFunc)(uint8_t octave, int note, uint32_t bend)) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    reclaim();
+    uint32_t mask = activeMask;
+    while (mask) {
+        uint8_t i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        __atomic_store_n(&voices[i].stepSize, stepSizeFunc(voices[i].octave, voices[i].note, bend), __ATOMIC_RELAXED);
+    }
+    xSemaphoreGive(mutex);
+}
+
+void VoicePool::setLevel(uint8_t idx, uint16_t level) {
+    __atomic_store_n(&voices[idx].level,level,__ATOMIC_RELAXED);
+}
+
+void VoicePool::setPolicy(VoiceSteal stealPolicy) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    policy = stealPolicy;
+    xSemaphoreGive(mutex);
+}
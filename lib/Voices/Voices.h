@@ -0,0 +1,91 @@
+#ifndef VOICES_H
+#define VOICES_H
+
+#include <STM32FreeRTOS.h>
+#include <constants.h>
+
+static_assert(ACCUMULATORS <= 32, "active voices are tracked in a 32 bit mask");
+
+const uint8_t NO_VOICE = UINT8_MAX;
+
+//Voice Stealing - which voice a new note takes when all ACCUMULATORS are sounding
+// OLDEST    - the voice that was allocated first
+// QUIETEST  - the voice with the lowest level (oldest if equal)
+// SAME_NOTE - a repeated note reuses its own voice, otherwise the oldest
+// With OLDEST and QUIETEST a repeated note gets a fresh voice and its previous voice is released
+enum VoiceSteal { STEAL_OLDEST, STEAL_QUIETEST, STEAL_SAME_NOTE };
+
+//Voice flags - shared between the pool and the renderer
+const uint8_t VOICE_RESTART = 0x1; // (re)started by the pool, not yet seen by the renderer
+const uint8_t VOICE_GATE    = 0x2; // key held - cleared on release, the voice keeps sounding
+const uint8_t VOICE_DONE    = 0x4; // envelope finished - the pool returns it to the free list
+
+struct Voice {
+    uint8_t note;
+    uint8_t octave;
+    uint32_t stepSize; // final step size including octave and pitch bend
+    uint32_t age;      // allocation order
+    uint16_t level;    // loudness for stealing
+    uint8_t flags;
+};
+
+// Fixed pool of voices - slots never move, so readers only see a voice once it is complete
+// Allocation and release are O(1) through a free list, notes map straight to their voice
+// Released voices stay active until the renderer marks them done at the end of their envelope
+class VoicePool {
+    private:
+        Voice voices[ACCUMULATORS];
+        uint8_t freeList[ACCUMULATORS];
+        uint8_t freeCount = 0;
+        uint8_t noteVoice[OCTAVES][12];
+        uint32_t activeMask = 0;
+        uint32_t nextAge = 0;
+        VoiceSteal policy;
+        SemaphoreHandle_t mutex;
+
+        uint8_t steal();
+
+        void release(uint8_t idx);
+
+        void reclaim();
+
+    public:
+        VoicePool(VoiceSteal stealPolicy = STEAL_OLDEST);
+
+        // Starts a note and returns its voice
+        uint8_t noteOn(uint8_t octave, uint8_t note, uint32_t stepSize);
+
+        void noteOff(uint8_t octave, uint8_t note);
+
+        // Bit i is set while voice i is sounding - walk with __builtin_ctz
+        uint32_t getActiveMask() const;
+
+        // True while a key holds the note - released notes ringing out do not count
+        bool isHeld(uint8_t octave, uint8_t note) const;
+
+        uint8_t getNote(uint8_t idx) const;
+
+        uint8_t getOctave(uint8_t idx) const;
+
+        uint32_t getStepSize(uint8_t idx) const;
+
+        // Renderer side - returns the voice flags and clears VOICE_RESTART
+        uint8_t takeFlags(uint8_t idx);
+
+        // Renderer side - envelope has ended, unless the voice was restarted meanwhile
+        void finish(uint8_t idx);
+
+        VoiceSteal getPolicy() const;
+
+        void setStepSize(uint8_t idx, uint32_t stepSize);
+
+        // Recalculates every active voice's step size under the pool mutex, e.g. for pitch bend
+        // Also returns finished voices to the free list
+        void retune(uint32_t bend, uint32_t (*stepSizeFunc)(uint8_t octave, int note, uint32_t bend));
+
+        void setLevel(uint8_t idx, uint16_t level);
+
+        void setPolicy(VoiceSteal stealPolicy);
+};
+
+#endif
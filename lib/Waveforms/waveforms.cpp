@@ -1,91 +1,112 @@
 #include <waveforms.h>
 #include <math.h>
+#include <cx_math.h>
+#include <constants.h>
 
-const int lut[256] = {
-   0,   3,   6,   9,  12,  16,  19,  22,  25,  28,
-  31,  34,  37,  40,  43,  46,  49,  51,  54,  57,
-  60,  63,  65,  68,  71,  73,  76,  78,  81,  83,
-  85,  88,  90,  92,  94,  96,  98, 100, 102, 104,
- 106, 107, 109, 111, 112, 113, 115, 116, 117, 118,
- 120, 121, 122, 122, 123, 124, 125, 125, 126, 126,
- 126, 127, 127, 127, 127, 127, 127, 127, 126, 126,
- 126, 125, 125, 124, 123, 122, 122, 121, 120, 118,
- 117, 116, 115, 113, 112, 111, 109, 107, 106, 104,
- 102, 100,  98,  96,  94,  92,  90,  88,  85,  83,
-  81,  78,  76,  73,  71,  68,  65,  63,  60,  57,
-  54,  51,  49,  46,  43,  40,  37,  34,  31,  28,
-  25,  22,  19,  16,  12,   9,   6,   3,   0,  -3,
-  -6,  -9, -12, -16, -19, -22, -25, -28, -31, -34,
- -37, -40, -43, -46, -49, -51, -54, -57, -60, -63,
- -65, -68, -71, -73, -76, -78, -81, -83, -85, -88,
- -90, -92, -94, -96, -98,-100,-102,-104,-106,-107,
--109,-111,-112,-113,-115,-116,-117,-118,-120,-121,
--122,-122,-123,-124,-125,-125,-126,-126,-126,-127,
--127,-127,-127,-127,-127,-127,-126,-126,-126,-125,
--125,-124,-123,-122,-122,-121,-120,-118,-117,-116,
--115,-113,-112,-111,-109,-107,-106,-104,-102,-100,
- -98, -96, -94, -92, -90, -88, -85, -83, -81, -78,
- -76, -73, -71, -68, -65, -63, -60, -57, -54, -51,
- -49, -46, -43, -40, -37, -34, -31, -28, -25, -22,
- -19, -16, -12,  -9,  -6,  -3 };
-
-int32_t Vout;
-
-int32_t sawtoothGen(int32_t scaledPhase) {
-    Vout = scaledPhase;
-    return Vout;
+//Band-limited wavetables
+// One table per band of step sizes, where a band is the position of the step size's top bit.
+// A step size with top bit b plays a fundamental below 2^(b+1) * SAMPLE_RATE / 2^32, so only
+// the first 2^(30-b) harmonics fit below Nyquist. Tables are capped at WAVETABLE_SIZE / 2 - 1 harmonics.
+const int WAVETABLE_BANDS = 8;
+const int WAVETABLE_FIRST_BIT = 23; // step sizes below 2^24 all use the first table
+
+struct Wavetables {
+    int16_t table[WAVETABLE_BANDS][WAVETABLE_SIZE + 1];
+};
+
+struct SineTable {
+    int16_t table[SINE_TABLE_SIZE + 1];
+};
+
+constexpr int bandHarmonics(int band) {
+    return std::min(WAVETABLE_SIZE / 2 - 1, 1 << (WAVETABLE_BANDS - 1 - band));
 }
 
-int32_t sinGen(int32_t scaledPhase) {
-    uint8_t index = scaledPhase + 128; //scaledPhase becomes index to look up table
-    Vout = lut[index];                 //look up table
-    return Vout;
+constexpr double tableSine(int n, int size) {
+    int reduced = (n < size / 2) ? n : n - size; // keep the argument within +/- pi
+    return cx::sin(2 * PI * reduced / size);
 }
 
-int32_t squareGen(int32_t scaledPhase) {
-    Vout = scaledPhase < 0 ? -128 : 127;
-    return Vout;
+constexpr int16_t toQ15(double sample) {
+    return (int16_t)((sample > 32767) ? 32767 : (sample < -32768) ? -32768 : sample);
 }
 
-int32_t triangleGen(int32_t scaledPhase) {
-    if (scaledPhase <= 0) { Vout = 2 * (scaledPhase + 64); }
-    else { Vout = 2 * (64 - scaledPhase); }
-    return Vout;
+//Additive synthesis of each band - shapes and phases match the naive generators that
+//host/bench/synth_bench.cpp keeps as its baseline
+constexpr Wavetables constructWavetables(int waveSelect) {
+    double sine[WAVETABLE_SIZE] = {};
+    for (int n = 0; n < WAVETABLE_SIZE; n++) { sine[n] = tableSine(n, WAVETABLE_SIZE); }
+
+    Wavetables tables = {};
+    for (int band = 0; band < WAVETABLE_BANDS; band++) {
+        for (int n = 0; n < WAVETABLE_SIZE; n++) {
+            double sum = 0;
+            for (int k = 1; k <= bandHarmonics(band); k++) {
+                int index = (k * n) % WAVETABLE_SIZE;
+                if (waveSelect == 0) { // rising ramp
+                    sum -= (2 / PI) * sine[index] / k;
+                } else if (waveSelect == 2 && (k % 2)) { // low then high
+                    sum -= (4 / PI) * sine[index] / k;
+                } else if (waveSelect == 3 && (k % 2)) { // low at start, peak half way
+                    sum -= (8 / (PI * PI)) * sine[(index + WAVETABLE_SIZE / 4) % WAVETABLE_SIZE] / (k * k);
+                }
+            }
+            double headroom = (waveSelect == 3) ? 1.0 : 1.18; // Gibbs overshoot at the saw and square edges
+            tables.table[band][n] = toQ15(sum * 32767 / headroom);
+        }
+        tables.table[band][WAVETABLE_SIZE] = tables.table[band][0];
+    }
+    return tables;
 }
 
-int32_t waveformGenerator(uint32_t phaseAcc, int waveSelect) {
-    int32_t scaledPhase = (phaseAcc >> 24) - 128;
-    if (waveSelect == 0) { return sawtoothGen(scaledPhase); }
-    else if (waveSelect == 1) { return sinGen(scaledPhase); }
-    else if (waveSelect == 2) { return squareGen(scaledPhase); }
-    else if (waveSelect == 3) { return triangleGen(scaledPhase); }
-    else { return 0; }
+constexpr SineTable constructSineTable() {
+    SineTable sine = {};
+    for (int n = 0; n < SINE_TABLE_SIZE; n++) { sine.table[n] = toQ15(tableSine(n, SINE_TABLE_SIZE) * 32767); }
+    sine.table[SINE_TABLE_SIZE] = sine.table[0];
+    return sine;
 }
 
-//vibrato using joystick Y - this is over a range of 2 keys (whole tone) each direction
-uint32_t vibratoFunc(const uint32_t stepSizes[12], int firstKeyPressed, int32_t joyYInput){
-    uint32_t noteBelow;
-    uint32_t noteAbove;
-    uint32_t thisNote = stepSizes[firstKeyPressed];
-    uint32_t bendStepSize;
-    joyYInput = joyYInput - 512;
-
-    if (firstKeyPressed == 0 || firstKeyPressed == 1) {
-        noteAbove = stepSizes[firstKeyPressed + 2];
-        noteBelow = stepSizes[firstKeyPressed + 10] / 2;
-    } else if (firstKeyPressed == 11 || firstKeyPressed == 10) {
-        noteAbove = stepSizes[firstKeyPressed - 10] * 2;
-        noteBelow = stepSizes[firstKeyPressed - 2];
-    } else {
-        noteAbove = stepSizes[firstKeyPressed + 2];
-        noteBelow = stepSizes[firstKeyPressed - 2];
-    }
+constexpr Wavetables sawtoothTables = constructWavetables(0);
+constexpr Wavetables squareTables   = constructWavetables(2);
+constexpr Wavetables triangleTables = constructWavetables(3);
+constexpr SineTable sineTable = constructSineTable();
+const int16_t silenceTable[3] = {0};
+
+Wavetable selectWavetable(int waveSelect, uint32_t stepSize) {
+    int band = (stepSize == 0) ? 0 : (31 - __builtin_clz(stepSize)) - WAVETABLE_FIRST_BIT;
+    band = std::min(std::max(band, 0), WAVETABLE_BANDS - 1);
+    if (waveSelect == 0) { return {sawtoothTables.table[band], WAVETABLE_BITS}; }
+    else if (waveSelect == 1) { return {sineTable.table, SINE_TABLE_BITS}; }
+    else if (waveSelect == 2) { return {squareTables.table[band], WAVETABLE_BITS}; }
+    else if (waveSelect == 3) { return {triangleTables.table[band], WAVETABLE_BITS}; }
+    else { return {silenceTable, 1}; }
+}
+
+//Pitch bend table
+// Q16 step size multipliers for each joystick position (10 bit reading >> 2), centre (128) is exactly 1.0
+const int BEND_TABLE_SIZE = 256;
 
-    if (joyYInput > 0) {
-        bendStepSize = thisNote + (joyYInput / 512.0) * (noteAbove - thisNote);
-    } else {
-        bendStepSize = thisNote + (joyYInput / 512.0) * (thisNote - noteBelow);
+struct BendTable {
+    uint32_t multiplier[BEND_TABLE_SIZE];
+};
+
+constexpr BendTable constructBendTable() {
+    BendTable table = {};
+    for (int i = 0; i < BEND_TABLE_SIZE; i++) {
+        double semitones = BEND_RANGE * (i - BEND_TABLE_SIZE / 2) / (double)(BEND_TABLE_SIZE / 2);
+        table.multiplier[i] = (uint32_t)(cx::pow(2, semitones / 12.0) * 65536 + 0.5);
     }
+    return table;
+}
+
+constexpr BendTable bendTable = constructBendTable();
+
+uint32_t bendMultiplier(int32_t joyYInput) {
+    joyYInput = std::min(std::max(joyYInput, (int32_t)0), (int32_t)1023);
+    return bendTable.multiplier[joyYInput >> 2];
+}
 
-    return bendStepSize;
+//vibrato using joystick Y - over BEND_RANGE semitones each direction, no floating point
+uint32_t vibratoFunc(uint8_t octave, int note, uint32_t bend){
+    return applyBend(stepSizeFor(octave, note), bend);
 }
\ No newline at end of file
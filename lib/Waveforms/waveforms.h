@@ -3,8 +3,42 @@
 
 #include <Arduino.h>
 
-int32_t waveformGenerator(uint32_t phaseAcc, int waveSelect);
+//Wavetable sizes - entries per cycle are 2^bits, larger tables cost flash but not time
+const int WAVETABLE_BITS = 8;   // band-limited tables: 8 (12 KB) or 10 (48 KB)
+const int SINE_TABLE_BITS = 10; // sine table: 8, 10 or 12 (8 KB)
+const int WAVETABLE_SIZE = 1 << WAVETABLE_BITS;
+const int SINE_TABLE_SIZE = 1 << SINE_TABLE_BITS;
 
-uint32_t vibratoFunc(const uint32_t stepSizes[12], int firstKeyPressed, int32_t joyYInput);
+//Linear interpolation between table entries using the fractional phase bits
+//Costs a second load and a multiply per voice per sample - disable for the cheapest lookup
+const bool WAVETABLE_INTERPOLATE = true;
+
+//Q15 samples with a guard entry after the last one, so interpolation never wraps
+struct Wavetable {
+    const int16_t* samples;
+    uint8_t bits;
+};
+
+//Band-limited table for a waveform at a given step size - select once per block, not per sample
+Wavetable selectWavetable(int waveSelect, uint32_t stepSize);
+
+//Q15 sample at a phase
+inline int32_t wavetableLookup(const int16_t* samples, uint8_t bits, uint32_t phaseAcc) {
+    uint32_t index = phaseAcc >> (32 - bits);
+    if (!WAVETABLE_INTERPOLATE) { return samples[index]; }
+    int32_t frac = (phaseAcc << bits) >> 17; // top 15 fractional bits
+    int32_t a = samples[index];
+    return a + (((samples[index + 1] - a) * frac) >> 15);
+}
+
+//Q16 pitch bend multiplier for a joystick reading - look up once per update and share between voices
+uint32_t bendMultiplier(int32_t joyYInput);
+
+inline uint32_t applyBend(uint32_t stepSize, uint32_t bend) {
+    return ((uint64_t)stepSize * bend) >> 16;
+}
+
+//Final step size of a note including octave and pitch bend
+uint32_t vibratoFunc(uint8_t octave, int note, uint32_t bend);
 
 #endif
\ No newline at end of file
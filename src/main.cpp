@@ -7,6 +7,15 @@
 #include <ES_CAN.h>
 #include <ES_IO.h>
 #include <waveforms.h>
+#include <Voices.h>
+#include <Filter.h>
+#include <AudioOut.h>
+#include <Renderer.h>
+#include <Profiler.h>
+#include <LatencyTrace.h>
+#include <TraceRing.h>
+#include <KeyFrame.h>
+#include <KeyDebounce.h>
 
 // #define DISABLE_THREADS
 // #define DISABLE_SOUND
@@ -20,56 +29,142 @@
 // #define TEST_DISPLAY
 // #define TEST_DECODE
 // #define TEST_TRANSMIT
+// #define TEST_RENDER
+// #define SHOW_UNDERRUNS
+// #define SHOW_CAN_ERRORS
+// #define TEST_SAMPLE_ISR
+// #define PROFILE_TASKS
+// #define TRACE_LATENCY
+// #define TRACE_EVENTS
+
+//Event tracing - binary records streamed by traceDrainTask, see host/tools/trace_decode.cpp
+#ifdef TRACE_EVENTS
+#define TRACE_EVENT(event, a, b) traceRing.write(event, a, b)
+#else
+#define TRACE_EVENT(event, a, b)
+#endif
 
-//Interrupt Service Routine - Sets audio voltage
-void sampleISR() {
-    static uint32_t phaseAcc[ACCUMULATORS] = {0, 0, 0, 0};
+//Profiling - cycle counts of every ISR call and task loop iteration, printed from loop()
+// Also marks the start and end in the event trace, except for the sample ISR and the 1 ms key matrix
+// sample which run too often
+#ifdef PROFILE_TASKS
+#define PROFILE_CYCLES_BEGIN() uint32_t profileStart = cycleCount()
+#define PROFILE_CYCLES_END(slot) profiles[slot].record(cycleCount() - profileStart)
+#else
+#define PROFILE_CYCLES_BEGIN()
+#define PROFILE_CYCLES_END(slot)
+#endif
+#define PROFILE_TRACED(slot) (slot != PROFILE_SAMPLE_ISR && slot != PROFILE_MATRIX_SCAN)
+#define PROFILE_BEGIN(slot) PROFILE_CYCLES_BEGIN(); if (PROFILE_TRACED(slot)) { TRACE_EVENT(EVENT_BEGIN, slot, 0); }
+#define PROFILE_END(slot) PROFILE_CYCLES_END(slot); if (PROFILE_TRACED(slot)) { TRACE_EVENT(EVENT_END, slot, 0); }
+
+//Latency tracing - key presses carry their scan time, each stage they pass records its latency
+#ifdef TRACE_LATENCY
+// A key frame is followed by its lowest newly pressed note
+#define TRACE_HOP(msg, stage) if ((msg)[0] == 'K' && keyFramePressed(msg) >= 0) { latencyTrace.hop(keyFrameOctave(msg), keyFramePressed(msg), stage, traceStampOf(msg), traceClock.now()); }
+#else
+#define TRACE_HOP(msg, stage)
+#endif
 
-    uint8_t volume = sysState.getVolume();
-    uint8_t waveform = sysState.getWaveform();
-    uint8_t notes = 0;
-    int Vout = 0;
-    for (int i = 0; i < ACCUMULATORS; i++) {
-        uint32_t thisStepSize = __atomic_load_n(&currentStepSize[i], __ATOMIC_RELAXED);
-        uint32_t thisOctave = __atomic_load_n(&notesPlaying[i][1], __ATOMIC_RELAXED);
-        uint32_t thisNote = __atomic_load_n(&notesPlaying[i][0], __ATOMIC_RELAXED);
+//Renders one block of samples into a half of the double buffer
+void renderBlock(StereoSample* block) {
+    static Renderer renderer;
+    RenderControls controls = {
+        sysState.getVolume(),
+        sysState.getWaveform(),
+        sysState.getEnvelope(),
+        sysState.getFilterMode(),
+        __atomic_load_n(&filterCutoff, __ATOMIC_RELAXED)
+    };
+    renderer.renderBlock(voicePool, controls, block);
+}
 
-        if (thisNote != 999) {
-            //implement octave select
-            if(thisOctave > 4){ thisStepSize <<= (thisOctave - 4); }
-            else{ thisStepSize >>= (4 - thisOctave); }
-            phaseAcc[i] += thisStepSize;
+//Interrupt Service Routine - Sets audio voltage from the double buffer
+void sampleISR() {
+    PROFILE_BEGIN(PROFILE_SAMPLE_ISR);
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    #ifdef TRACE_EVENTS
+    uint32_t underruns = audioBuffer.getUnderruns();
+    #endif
+    audioOutWrite(audioBuffer.nextSample(&higherPriorityTaskWoken));
+    #ifdef TRACE_EVENTS
+    if (audioBuffer.getUnderruns() != underruns) { TRACE_EVENT(EVENT_UNDERRUN, 0, 0); }
+    #endif
+    PROFILE_END(PROFILE_SAMPLE_ISR);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
 
-            Vout += waveformGenerator(phaseAcc[i], waveform) << 3; // scaling for audibility
+//Interrupt Service Routine - CAN Reciever for key frames and trace syncs (FIFO 0)
+// Key frames go straight to playNotesTask, skipping the decode task
+// Empties the FIFO - the 3 deep FIFO can fill while the ISR waits behind a higher priority one
+void CAN_RX_KEYS_ISR (void) {
+    PROFILE_BEGIN(PROFILE_CAN_RX_KEYS_ISR);
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    uint8_t RX_Message_ISR[8];
+    uint32_t ID;
+    while (CAN_CheckRXLevel(0)) {
+        CAN_RX(ID, RX_Message_ISR, 0);
+        #ifdef TRACE_LATENCY
+        if (RX_Message_ISR[0] == 'S') { traceClock.sync(traceStampOf(RX_Message_ISR), micros()); }
+        TRACE_HOP(RX_Message_ISR, HOP_RX_ISR);
+        #endif
+        TRACE_EVENT(EVENT_CAN_RX, RX_Message_ISR[0], RX_Message_ISR[1]);
+        if (RX_Message_ISR[0] == 'K') {
+            if (xQueueSendFromISR(notePlayingQ, RX_Message_ISR, &higherPriorityTaskWoken) != pdTRUE) {
+                __atomic_fetch_add(&canRxDropped[0], 1, __ATOMIC_RELAXED);
+            }
+            TRACE_EVENT(EVENT_QUEUE_SEND, QUEUE_NOTE_PLAYING, RX_Message_ISR[0]);
         }
     }
-
-    Vout = Vout >> (8 - volume);
-    Vout = Vout / ACCUMULATORS; // only one divide is computationally nicer
-
-    analogWrite(OUTL_PIN, std::min(std::max(Vout + 128, 0), 255)); // try average each note pressed corresponding voltage - separate phase accumulator for each.
-    analogWrite(OUTR_PIN, std::min(std::max(Vout + 128, 0), 255)); // try average each note pressed corresponding voltage - separate phase accumulator for each.
+    PROFILE_END(PROFILE_CAN_RX_KEYS_ISR);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken); // playNotesTask runs as soon as the ISR returns
 }
 
-
-//Interrupt Service Routine - CAN Reciever
+//Interrupt Service Routine - CAN Reciever for state and config messages (FIFO 1)
 void CAN_RX_ISR (void) {
+    PROFILE_BEGIN(PROFILE_CAN_RX_ISR);
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
     uint8_t RX_Message_ISR[8];
     uint32_t ID;
-    CAN_RX(ID, RX_Message_ISR);
-    xQueueSendFromISR(msgInQ, RX_Message_ISR, NULL); // sends data from ISR to msgInQ
+    while (CAN_CheckRXLevel(1)) {
+        CAN_RX(ID, RX_Message_ISR, 1);
+        TRACE_EVENT(EVENT_CAN_RX, RX_Message_ISR[0], RX_Message_ISR[1]);
+        bool handshakeMsg = (RX_Message_ISR[0] == 'N' || RX_Message_ISR[0] == 'F') && __atomic_load_n(&handshaking, __ATOMIC_RELAXED);
+        QueueHandle_t queue = handshakeMsg ? handshakeQ : msgInQ; // handshake messages wake handshakeTask directly
+        if (xQueueSendFromISR(queue, RX_Message_ISR, &higherPriorityTaskWoken) != pdTRUE) {
+            __atomic_fetch_add(&canRxDropped[1], 1, __ATOMIC_RELAXED);
+        }
+        if (!handshakeMsg) { TRACE_EVENT(EVENT_QUEUE_SEND, QUEUE_MSG_IN, RX_Message_ISR[0]); }
+    }
+    PROFILE_END(PROFILE_CAN_RX_ISR);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
 }
 
-//Interrupt Service Routine - CAN Transmitter
+//Interrupt Service Routine - CAN transmit mailbox empty, after the frame was acknowledged on the bus
+// The handshake waits for its claim to reach the other boards before it lets the next board go
 void CAN_TX_ISR (void) {
-    xSemaphoreGiveFromISR(CAN_TX_Semaphore, NULL);
+    if (!__atomic_load_n(&handshaking, __ATOMIC_RELAXED)) { return; }
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    xSemaphoreGiveFromISR(handshakeAck, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+//Function to send a message on CAN - returns at once, the message waits in ES_CAN's transmit ring
+// Urgent messages go ahead of everything waiting
+void transmit(uint8_t msgOut[8], bool urgent = false) {
+    if (!sysState.getConns()) { return; } // only sends if there are connections
+    #ifdef TRACE_LATENCY
+    if (msgOut[0] == 'S') { traceStamp(msgOut, traceClock.now()); } // urgent, so it waits as little as possible
+    TRACE_HOP(msgOut, HOP_TRANSMIT);
+    #endif
+    CAN_TX(canMessageId(msgOut[0], __atomic_load_n(&keySource, __ATOMIC_RELAXED)), msgOut, urgent);
+    TRACE_EVENT(EVENT_CAN_TX, msgOut[0], msgOut[1]);
 }
 
-//Function to send message to out queue with default arguments
+//Function to send message with default arguments
 void sendMsg (uint8_t msgChar, uint8_t octOrPos = 0,
               uint8_t noteOrAssign = 0, uint8_t vol = 0,
-              uint8_t conns = 0, /* add more if needed */
-              xQueueHandle msgQ = msgOutQ
+              uint8_t conns = 0 /* add more if needed */
 ) {
     uint8_t msgOut[8] = {0};
     msgOut[0] = msgChar;
@@ -77,19 +172,45 @@ void sendMsg (uint8_t msgChar, uint8_t octOrPos = 0,
     msgOut[2] = noteOrAssign;
     msgOut[3] = vol;
     msgOut[4] = conns;
-    // msgOut[5] = 0; add if needed
-    // msgOut[6] = 0; add if needed
-    // msgOut[7] = 0; add if needed
-    xQueueSend(msgQ, msgOut, portMAX_DELAY);
+    transmit(msgOut, msgChar == 'S');
+}
+
+//Function to send a settings change made on this board, as a delta stamped with its generation and source
+void sendSetting(uint8_t msgChar, uint8_t value) {
+    uint8_t source = __atomic_load_n(&keySource, __ATOMIC_RELAXED);
+    sendMsg(msgChar, source, sysState.nextGeneration(msgChar, source), value);
+}
+
+//Function to send the stack-wide state in one frame, layout in State.h
+void sendSnapshot() {
+    uint8_t msgOut[8] = {0};
+    sysState.packSnapshot(msgOut);
+    transmit(msgOut);
+}
+
+//Function to send the note state of an octave, pressed are the notes held since the last frame
+// The receiver plays its own keys, other boards send them as urgent messages, ahead of config messages
+void sendKeys(uint8_t octave, uint8_t sequence, uint16_t notes, uint16_t pressed, bool receiver) {
+    uint8_t msgOut[8] = {0};
+    packKeyFrame(msgOut, __atomic_load_n(&keySource, __ATOMIC_RELAXED), octave, sequence, notes, pressed);
+    #ifdef TRACE_LATENCY
+    if (pressed) { traceStamp(msgOut, traceClock.now()); } // bytes 5-7
+    #endif
+    if (receiver) {
+        xQueueSend(notePlayingQ, msgOut, portMAX_DELAY);
+        TRACE_EVENT(EVENT_QUEUE_SEND, QUEUE_NOTE_PLAYING, 'K');
+    } else {
+        transmit(msgOut, true);
+    }
 }
 
 //Function to reset output and returns number of connections
 uint8_t resetConnsRead() {
-    setOutMuxBit(HKOE_BIT, HIGH);
-    setOutMuxBit(HKOW_BIT, HIGH);
+    keyMatrix.setOutMuxBit(HKOE_BIT, HIGH);
+    keyMatrix.setOutMuxBit(HKOW_BIT, HIGH);
     std::bitset<2> invHandShake = 0b00; // {west, east}
-    invHandShake[1] = !readKey(5, 3);
-    invHandShake[0] = !readKey(6, 3);
+    invHandShake[1] = !keyMatrix.readKey(5, 3);
+    invHandShake[0] = !keyMatrix.readKey(6, 3);
     uint8_t conns = invHandShake.to_ulong();
     sysState.setConns(conns);
     #ifndef TEST_DECODE
@@ -103,20 +224,15 @@ uint8_t resetConnsRead() {
 void updateConnections(uint8_t newConns) {
     uint8_t msgOut[8] = {0};
     int diff = newConns - sysState.getConns();
+    sysState.setConns(newConns); // before sending, as transmit drops messages while there are no connections
 
     uint8_t thisOct = sysState.getOctave();
     uint8_t lowestOct = sysState.getLowestOctave();
     uint8_t highestOct = sysState.getHighestOctave();
     uint8_t receiverOct = sysState.getReceiverOctave();
 
-    if (diff > 0){ // New Board Connected
-        delay(1000); // Account for delay when turning on keyboard
-        if (knobs[1].isLoaded()){
-            sendMsg('W', 0, 0, knobs[1].getRotation());
-        }
-        if (knobs[3].isLoaded()) {
-            sendMsg('V', 0, 0, knobs[3].getRotation());
-        }
+    if (diff > 0){ // New Board Connected - connectionsTask has given it CONN_BOOT_TIME to start
+        sendSnapshot(); // the newer settings win on both sides when two stacks join
     }
     if (abs(diff) == 1) { // East
         uint8_t newHighest = std::min(highestOct + 1, 8); // New Connection
@@ -125,6 +241,7 @@ void updateConnections(uint8_t newConns) {
             if (receiverOct > thisOct) {
                 sendMsg('T', thisOct);
                 sysState.setReceiver(true);
+                sysState.setReceiverOctave(thisOct);
             }
         }
         if (thisOct > newHighest) { newHighest = thisOct; } // Bounds Check
@@ -140,6 +257,7 @@ void updateConnections(uint8_t newConns) {
             if (receiverOct < thisOct) {
                 sendMsg('T', thisOct);
                 sysState.setReceiver(true);
+                sysState.setReceiverOctave(thisOct);
             }
         }
         if (thisOct < newLowest) { newLowest = thisOct; } // Bounds Check
@@ -149,7 +267,14 @@ void updateConnections(uint8_t newConns) {
             sendMsg('L', newLowest, 1);
         }
     }
-    sysState.setConns(newConns);
+}
+
+//Starts a knob counting from the current state of its A and B inputs
+// Knobs 3 and 2 are on row 3, knobs 1 and 0 on row 4, with A in the even column and B next to it
+void initKnob(uint8_t knobNumber) {
+    uint8_t row = 4 - (knobNumber / 2);
+    uint8_t col = 2 * (1 - (knobNumber % 2));
+    knobs[knobNumber].init(keyMatrix.readKey(row, col), keyMatrix.readKey(row, col + 1));
 }
 
 //Assigns Octaves based on position from handshake
@@ -161,86 +286,118 @@ void assignOctaves(uint8_t max, uint8_t pos) {
     uint8_t highestOctave = std::min(4 + half + even, 7);
 
     sysState.setOctave(octave);
+    __atomic_store_n(&keySource, octave, __ATOMIC_RELAXED);
     sysState.setLowestOctave(lowestOctave);
     sysState.setHighestOctave(highestOctave);
     if (octave == 4) { sysState.setReceiver(true); }
     knobs[2].setRotation(octave);
 
-    knobs[1].init(1);
-    knobs[2].init(2);
-    knobs[3].init(3);
+    initKnob(0);
+    initKnob(1);
+    initKnob(2);
+    initKnob(3);
+}
+
+//Ends the handshake with the octaves for this board's position, and starts the key scan
+// The east detect line is raised again so the east neighbour's first scan sees the connection
+void finishHandshake(uint8_t max, uint8_t pos) {
+    if (__atomic_exchange_n(&handshaking, false, __ATOMIC_RELAXED)) { // not already ended by decodeMessageTask
+        keyMatrix.setOutMuxBit(HKOE_BIT, HIGH);
+        assignOctaves(max, pos);
+        #ifndef TEST_HANDSHAKE
+        vTaskResume(scanKeysHandle);
+        #endif
+    }
+    #ifndef TEST_HANDSHAKE
+    #ifndef SHOW_STACK_WATERMARKS
+    vTaskDelete(NULL);
+    #else
+    vTaskSuspend(NULL);
+    #endif
+    #endif
 }
 
 //Thread Task - Handshake on startup to assing octaves
+// Boards claim positions from west to east. A board's turn comes when its west neighbour lets go of
+// the detect line, or when it has seen no west neighbour for HANDSHAKE_SETTLE. It claims the next
+// position with an N message and lets go of its own east line once the claim has been acknowledged
+// on the bus, so the claim reaches the next board before its turn does. The eastmost board claims
+// the last position with an F message instead, which ends the handshake everywhere.
 void handshakeTask(void* pvParameters) {
     uint8_t msgIn[8] = {0};
     uint8_t msgOut[8] = {0};
     std::bitset<2> handShakePins; // {!west, !east}
-    bool firstLoop = true;
-    bool eastMost  = false;
-    bool disableHSPin = false;
+    bool westNeighbour = false;   // seen since startup
+    uint8_t highest = UINT8_MAX;  // last position claimed, the westmost board claims 0
+    uint8_t position = 0;         // this board's
+    bool claimed = false;
+    TickType_t startTime = xTaskGetTickCount();
+    TickType_t lastHeard = startTime;
 
     #ifndef TEST_HANDSHAKE
-    delay(500); // Wait for boards to turn on
     while(1)
     #endif
     {
         #ifndef TEST_HANDSHAKE
-        delay(50); // wait for CAN messages to be read and variables updated + handshake connections
-        handShakePins[1] = readKey(5, 3);
-        handShakePins[0] = readKey(6, 3, !disableHSPin);
+        bool received = xQueueReceive(handshakeQ, msgIn, HANDSHAKE_POLL) == pdTRUE; // a message, or the next pin poll
+        handShakePins[1] = keyMatrix.readKey(5, 3);
+        handShakePins[0] = keyMatrix.readKey(6, 3, !claimed);
+        bool settled = (xTaskGetTickCount() - startTime) >= HANDSHAKE_SETTLE;
         #else
-        delayMicroseconds(675);
-        handShakePins[1] = true;
-        handShakePins[0] = true;
-        eastMost = true;
+        bool received = false;
+        handShakePins = 0b11;
+        westNeighbour = true;
+        claimed = false;
+        handshaking = true;
+        bool settled = true;
         #endif
-
-        // If Only Keyboard - end handshake
-        if (handShakePins.all() && firstLoop) {
-            assignOctaves(0, 0);
-            #ifndef TEST_HANDSHAKE
-            vTaskResume(scanKeysHandle);
-            #ifndef SHOW_STACK_WATERMARKS
-            vTaskDelete(NULL);
-            #else
-            vTaskSuspend(NULL);
-            #endif
-            #endif
-        } else { firstLoop = false; }
-
-        // Sends Final handshake if eastmost keyboard
-        if (!handShakePins[1] && handShakePins[0] && !eastMost) {
-            eastMost = true;
-        }
-        // Only sends Final handshake if all handshakes are complete
-        if (handShakePins.all() && eastMost) { // Final handshake
-            uint8_t maxPos = sysState.getHighestOctave() + 1;
-            sysState.setOctave(maxPos);
-            msgOut[0] = 'F';
-            msgOut[1] = maxPos;
-            xSemaphoreTake(CAN_TX_Semaphore, portMAX_DELAY);
-            CAN_TX(0x123, msgOut);
-            assignOctaves(maxPos, maxPos);
-            #ifndef TEST_HANDSHAKE
-            vTaskResume(scanKeysHandle);
-            #ifndef SHOW_STACK_WATERMARKS
-            vTaskDelete(NULL);
-            #else
-            vTaskSuspend(NULL);
-            #endif
-            #endif
-        // Sends new handshake if next "westmost" keyboard & disables east output pin
-        } else if (handShakePins[1] && !disableHSPin) { // New handshake
-            uint8_t maxPos = sysState.getHighestOctave() + 1;
-            sysState.setOctave(maxPos);
-            sysState.setHighestOctave(maxPos);
-            msgOut[0] = 'N';
-            msgOut[1] = maxPos;
-            xSemaphoreTake(CAN_TX_Semaphore, portMAX_DELAY);
-            CAN_TX(0x123, msgOut);
-            disableHSPin = true;
+        PROFILE_BEGIN(PROFILE_HANDSHAKE);
+
+        // Messages are read after the pins - a claim is acknowledged before the line drops, so a
+        // released west line always comes with the west neighbour's claim
+        received = received || xQueueReceive(handshakeQ, msgIn, 0) == pdTRUE;
+        while (received) {
+            lastHeard = xTaskGetTickCount();
+            if (msgIn[0] == 'N') {
+                highest = msgIn[1];
+            } else if (msgIn[0] == 'F' && claimed) { // Final handshake
+                finishHandshake(msgIn[1], position);
+            }
+            received = xQueueReceive(handshakeQ, msgIn, 0) == pdTRUE;
+        }
+        westNeighbour = westNeighbour || !handShakePins[1];
+
+        if (!claimed && handShakePins[1] && (westNeighbour || settled)) { // this board's turn
+            if (handShakePins[0] && settled && !westNeighbour) { // If Only Keyboard - end handshake
+                finishHandshake(0, 0);
+            } else if (handShakePins[0] && settled) { // Final handshake if eastmost keyboard
+                position = highest + 1;
+                claimed = true;
+                sysState.setOctave(position);
+                msgOut[0] = 'F';
+                msgOut[1] = position;
+                CAN_TX(canMessageId(msgOut[0], position), msgOut);
+                TRACE_EVENT(EVENT_CAN_TX, msgOut[0], msgOut[1]);
+                finishHandshake(position, position);
+            } else if (!handShakePins[0]) { // New handshake, then disables east output pin
+                position = highest + 1;
+                highest = position;
+                claimed = true;
+                sysState.setOctave(position);
+                msgOut[0] = 'N';
+                msgOut[1] = position;
+                xSemaphoreTake(handshakeAck, 0); // no older acknowledgement
+                CAN_TX(canMessageId(msgOut[0], position), msgOut);
+                TRACE_EVENT(EVENT_CAN_TX, msgOut[0], msgOut[1]);
+                xSemaphoreTake(handshakeAck, HANDSHAKE_ACK_TIME);
+                keyMatrix.setOutMuxBit(HKOE_BIT, LOW);
+                lastHeard = xTaskGetTickCount();
+            }
+        } else if (claimed && highest > position && (xTaskGetTickCount() - lastHeard) >= HANDSHAKE_TIMEOUT) {
+            // Fallback - boards to the east have claimed, but the final handshake never came
+            finishHandshake(highest, position);
         }
+        PROFILE_END(PROFILE_HANDSHAKE);
     }
 }
 
@@ -252,33 +409,28 @@ void playNotesTask(void * pvParameters) {
     {
         // Serial.println(notePlayingQ);
         xQueueReceive(notePlayingQ, &RX_Message_local, portMAX_DELAY); // the decoding happens here - feeds in from notePlayingQ to RX_Message
-        if (sysState.isReceiver()) {
-            if (RX_Message_local[0] == 'P') { // pressed
-                xSemaphoreTake(notesPlayingMutex, portMAX_DELAY);
-                for (int i = ACCUMULATORS - 1; i > 0; i--) {
-                    notesPlaying[i][0] = notesPlaying[i-1][0];
-                    notesPlaying[i][1] = notesPlaying[i-1][1];
-                }
-                notesPlaying[0][0] = RX_Message_local[2]; // note
-                notesPlaying[0][1] = RX_Message_local[1]; // octave
-                xSemaphoreGive(notesPlayingMutex);
-            } else { // released
-                xSemaphoreTake(notesPlayingMutex, portMAX_DELAY);
-                for (int i = 0; i < ACCUMULATORS; i++) {
-                    if (notesPlaying[i][0] == RX_Message_local[2] && notesPlaying[i][1] == RX_Message_local[1]) {
-                        // notesPlaying[0][0] = 999; // no note (0 is a note)
-                        for (int j = i; j < ACCUMULATORS-1; j++) {
-                            notesPlaying[j][0] = notesPlaying[j+1][0];
-                            notesPlaying[j][1] = notesPlaying[j+1][1];
-                        }
-                        notesPlaying[ACCUMULATORS-1][0] = 999;
-                        notesPlaying[ACCUMULATORS-1][1] = 4;
-                        break;
-                    }
+        PROFILE_BEGIN(PROFILE_PLAY_NOTES);
+        TRACE_EVENT(EVENT_QUEUE_RECEIVE, QUEUE_NOTE_PLAYING, RX_Message_local[0]);
+        TRACE_HOP(RX_Message_local, HOP_PLAY_NOTES);
+        // Every board keeps the key states, so a board that becomes the receiver knows what is held
+        uint8_t octave = keyFrameOctave(RX_Message_local);
+        uint16_t changed = keyStates.apply(RX_Message_local);
+        if (sysState.isReceiver() && changed) {
+            uint16_t held = keyStates.getNotes(octave);
+            uint32_t bend = __atomic_load_n(&pitchBend, __ATOMIC_RELAXED);
+            for (uint16_t notes = changed; notes; notes &= notes - 1) {
+                uint8_t note = __builtin_ctz(notes);
+                if (held & (1 << note)) { // pressed
+                    voicePool.noteOn(octave, note, vibratoFunc(octave, note, bend));
+                    TRACE_EVENT(EVENT_NOTE_ON, octave, note);
+                } else { // released
+                    voicePool.noteOff(octave, note);
+                    TRACE_EVENT(EVENT_NOTE_OFF, octave, note);
                 }
-                xSemaphoreGive(notesPlayingMutex);
             }
+            if (changed & held) { TRACE_HOP(RX_Message_local, HOP_NOTE_ON); }
         }
+        PROFILE_END(PROFILE_PLAY_NOTES);
     }
 }
 
@@ -289,26 +441,36 @@ void scanKeysTask(void * pvParameters) {
     #endif
 
     #ifndef TEST_KEYS
-    const TickType_t xFrequency = 20/portTICK_PERIOD_MS;
+    const TickType_t xFrequency = KEY_SCAN_PERIOD;
     TickType_t xLastWakeTime = xTaskGetTickCount();
-    setOutMuxBit(HKOE_BIT, HIGH);
-    setOutMuxBit(HKOW_BIT, HIGH);
+    keyMatrix.setOutMuxBit(HKOE_BIT, HIGH);
+    keyMatrix.setOutMuxBit(HKOW_BIT, HIGH);
     #endif
 
     std::bitset<28> inputs;
     std::bitset<28> prevInputs;
+    KeyDebounce debounce;
+    uint8_t scansSinceTick = 0;
     std::bitset<12> prevNotes;
     uint8_t prevConns;
-
-    bool connsChanged = false;
-    TickType_t connsChangeTime = xTaskGetTickCount();
+    #ifdef PROFILE_TASKS
+    uint32_t lastWake = 0;
+    #endif
 
     std::vector<std::bitset<28>> looped {};
     bool lastButton = 1; //button starts not-pressed
+    std::bitset<28> loopStep = 0xFFFFFFF; // looped inputs of the current tick
     int loopPointer = 0;
     int loopLength = 0;
 
     bool firstScan = true;
+    uint16_t sentNotes = 0;
+    uint8_t sentOctave = 0;
+    uint8_t keySequence = 0;
+    uint8_t scansSinceKeys = 0;
+    #ifdef TRACE_LATENCY
+    uint8_t scansSinceSync = 0;
+    #endif
 
     #ifndef TEST_KEYS
     while (1)
@@ -316,41 +478,50 @@ void scanKeysTask(void * pvParameters) {
     {
         #ifndef TEST_KEYS
         vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        TickType_t now = xTaskGetTickCount();
+        if (now - xLastWakeTime >= xFrequency) { xLastWakeTime = now; } // held up - missed samples are skipped, not taken back to back
+        #ifdef PROFILE_TASKS
+        uint32_t wake = cycleCount();
+        int32_t periodCycles = xFrequency * portTICK_PERIOD_MS * (F_CPU / 1000);
+        if (lastWake) { scanJitter.record(abs((int32_t)(wake - lastWake) - periodCycles)); }
+        lastWake = wake;
+        #endif
         #endif
-        prevInputs = sysState.getInputs();
 
-        // Gets Inputs
-        prevInputs = sysState.getInputs();
-        for (uint8_t i = 6; i != UINT8_MAX; i--) {
-            inputs <<= 4;
-            setRow(i);
-            digitalWrite(REN_PIN, HIGH);
-            delayMicroseconds(3);
-            inputs |= readCols().to_ulong();
+        // Samples and debounces the inputs - the rest only runs for a debounced change, or on a tick
+        std::bitset<28> changed;
+        {
+            PROFILE_BEGIN(PROFILE_MATRIX_SCAN); // the sample alone, without the rest of the scan
+            std::bitset<28> sample = keyMatrix.scan();
+            if (firstScan) { debounce.reset(sample); }
+            else { changed = debounce.update(sample); }
+            PROFILE_END(PROFILE_MATRIX_SCAN);
         }
+        bool tick = firstScan || ++scansSinceTick >= KEY_TICK_SCANS;
+        if (tick) { scansSinceTick = 0; }
+        #ifndef TEST_KEYS
+        else if (changed.none()) { continue; }
+        #endif
+
+        PROFILE_BEGIN(PROFILE_SCAN_KEYS);
+        prevInputs = sysState.getInputs();
+        inputs = debounce.getState();
 
         std::bitset<12> noteInputs = std::bitset<12>((inputs & NOTE_MASK).to_ulong());
         uint8_t connections = (!inputs[23] << 1) | !inputs[27]; // {west, east}
 
-        // Debouncing due to east and west reads being volatile during connection changes
-        // i.e 1 -> 2 is actually 1 -> 0 -> 2 or 1 -> 0 -> 2 -> 0 -> 2 etc.
+        // Changes go to connectionsTask, which debounces them and updates the other boards
         // Not first scan to readjust out bits from handshake + init connections
         if (firstScan) { // initialising connections
             firstScan = false;
             connections = resetConnsRead();
         }
         else if (connections != prevConns) {
-            connsChangeTime = xTaskGetTickCount();
-            connsChanged = true;
-        }
-        // Update connections after debounce time if changed
-        if (connsChanged && ((xTaskGetTickCount() - connsChangeTime) >= CONN_TIME)) {
-            updateConnections(connections);
-            connsChanged = false;
+            xQueueSend(connsQ, &connections, 0);
         }
 
         // Loading global variables for knob updates
-        int knob0rotation = knobs[0].getRotation(); // UNUSED
+        int knob0rotation = knobs[0].getRotation();
         int knob1rotation = knobs[1].getRotation();
         int knob2rotation = knobs[2].getRotation(); // UNUSED
         int knob3rotation = knobs[3].getRotation();
@@ -358,6 +529,9 @@ void scanKeysTask(void * pvParameters) {
         uint8_t octave   = sysState.getOctave();
         uint8_t volume   = sysState.getVolume();
         uint8_t waveform = sysState.getWaveform();
+        uint8_t envelope = sysState.getEnvelope();
+        uint8_t cutoff   = sysState.getCutoff();
+        bool knob0Filter = sysState.isKnob0Filter();
 
         // Knob Updates
         if (prevInputs != inputs) {
@@ -369,10 +543,26 @@ void scanKeysTask(void * pvParameters) {
             }
         }
 
+        // Knob 0 - Change Envelope Attack/Release Time or Filter Cutoff (Rotate)
+        if (!knob0Filter && envelope != knob0rotation && knobs[0].isLoaded()) {
+            sysState.setEnvelope(knob0rotation);
+            sendSetting('E', knob0rotation);
+        }
+        if (knob0Filter && cutoff != knob0rotation && knobs[0].isLoaded()) {
+            sysState.setCutoff(knob0rotation);
+            sendSetting('C', knob0rotation);
+        }
+        // Knob 2 - Switch Knob 0 between Envelope and Filter Cutoff (Press)
+        if (!inputs[20] && prevInputs[20]) {
+            knob0Filter = !knob0Filter;
+            sysState.setKnob0Filter(knob0Filter);
+            knobs[0].setUpperLimit(knob0Filter ? CUTOFF_SETTINGS - 1 : ENVELOPE_SETTINGS - 1);
+            knobs[0].setRotation(knob0Filter ? cutoff : envelope);
+        }
         // Knob 1 - Change Waveform (Rotate)
         if (waveform != knob1rotation && knobs[1].isLoaded()) {
             sysState.setWaveform(knob1rotation);
-            sendMsg('W', 0, 0, knob1rotation);
+            sendSetting('W', knob1rotation);
         }
         // Knob 2 - Change Octave (Rotate)
         if (octave != knob2rotation && knobs[2].isLoaded()) {
@@ -382,11 +572,18 @@ void scanKeysTask(void * pvParameters) {
         // Knob 3 - Change Volume (Rotate)
         if (volume != knob3rotation && knobs[3].isLoaded()) {
             sysState.setVolume(knob3rotation);
-            sendMsg('V', 0, 0, knob3rotation);
+            sendSetting('V', knob3rotation);
+        }
+        // Joystick - Cycle Filter Mode Off/Low/Band/High (Press)
+        if (!inputs[22] && prevInputs[22]) {
+            uint8_t filterMode = (sysState.getFilterMode() + 1) % FILTER_MODES;
+            sysState.setFilterMode(filterMode);
+            sendSetting('M', filterMode);
         }
         // Knob 3 - Set Transmitter (Press)
-        if (!inputs[21]) {
+        if (tick && !inputs[21]) {
             sysState.setReceiver(true);
+            sysState.setReceiverOctave(octave);
             uint8_t msgOut[8] = {0};
             sendMsg('T', octave);
         }
@@ -395,15 +592,16 @@ void scanKeysTask(void * pvParameters) {
         bool looping = sysState.isLooping();
         bool recordingNotes =  !inputs[24];
 
-        // Loop Playback
-        if (looping) {
-            inputs &= looped[loopPointer];
+        // Loop Playback - steps once a tick, changes in between play over the current step
+        if (looping && tick) {
+            loopStep = looped[loopPointer];
             if (loopPointer == loopLength - 1) { loopPointer = 0; }
             else { loopPointer ++; }
         }
+        if (looping) { inputs &= loopStep; }
 
-        // Loop Recording
-        if (recordingNotes && !looping) { looped.push_back(inputs); }
+        // Loop Recording - once a tick
+        if (recordingNotes && !looping && tick) { looped.push_back(inputs); }
 
         // Loop Start
         if (!recordingNotes && !looping && !lastButton) {
@@ -424,21 +622,35 @@ void scanKeysTask(void * pvParameters) {
             looped = {};
         }
 
-        // key change for CAN communication
-        for (int i = 0; i < 12; i++) {
-            if (prevInputs[i] != inputs[i]) {
-                uint8_t msgChar = inputs[i] ? 'R' : 'P';
-                xQueueHandle msgQ = sysState.isReceiver() ? notePlayingQ : msgOutQ;
-                sendMsg(msgChar, octave, i, volume, 0, msgQ);
-            }
+        // Key state for CAN communication - one frame with all notes when any key changes
+        uint16_t notes = ~inputs.to_ulong() & NOTE_MASK.to_ulong(); // keys are active low
+        bool receiver = sysState.isReceiver();
+        if (octave != sentOctave && sentNotes) { // releases the notes held in the previous octave
+            sendKeys(sentOctave, keySequence++, 0, 0, receiver);
+            sentNotes = 0;
+        }
+        if (notes != sentNotes || (tick && ++scansSinceKeys >= KEYS_REFRESH_SCANS)) {
+            sendKeys(octave, keySequence++, notes, notes & ~sentNotes, receiver);
+            sentNotes = notes;
+            sentOctave = octave;
+            scansSinceKeys = 0;
         }
 
+        #ifdef TRACE_LATENCY
+        // Trace clock - the receiver sends its time every TRACE_SYNC_SCANS scans
+        if (tick && ++scansSinceSync >= TRACE_SYNC_SCANS) {
+            scansSinceSync = 0;
+            if (sysState.isReceiver()) { sendMsg('S'); }
+        }
+        #endif
+
         // Update previous values to current values
         lastButton = inputs[24];
         prevInputs = inputs;
         prevNotes = noteInputs;
         prevConns = connections;
         sysState.setInputs(inputs);
+        PROFILE_END(PROFILE_SCAN_KEYS);
     }
 }
 
@@ -454,6 +666,7 @@ void displayUpdateTask(void * pvParameters) {
         #ifndef TEST_DISPLAY
         vTaskDelayUntil(&xLastWakeTime, xFrequency);
         #endif
+        PROFILE_BEGIN(PROFILE_DISPLAY);
 
         //Update display
         u8g2.clearBuffer();                 // clear the internal memory
@@ -467,6 +680,10 @@ void displayUpdateTask(void * pvParameters) {
             u8g2.print("4 Blind Men");
         }
 
+        const char* filterNames[FILTER_MODES] = {"", "LP", "BP", "HP"};
+        u8g2.setCursor(66, 10);
+        u8g2.print(filterNames[sysState.getFilterMode() % FILTER_MODES]);
+
         if (sysState.isLooping()) {
             u8g2.setCursor(83, 10);
             u8g2.print("Looping");
@@ -476,19 +693,18 @@ void displayUpdateTask(void * pvParameters) {
         std::string noteString = "";
 
         u8g2.setFont(u8g2_font_5x7_mf);
-        xSemaphoreTake(notesPlayingMutex, portMAX_DELAY);
         int nonzero = 0;
-        for (int i = ACCUMULATORS - 1; i >= 0; i--) {
-            if (notesPlaying[i][0] != 999) {
-                noteString = NOTE_NAMES[notesPlaying[i][0]];
-                noteString += std::to_string(notesPlaying[i][1]);
-
-                u8g2.setCursor(2 + 13*nonzero, 19);
-                u8g2.print(noteString.c_str());
-                nonzero++;
-            }
+        uint32_t mask = voicePool.getActiveMask();
+        while (mask) {
+            uint8_t i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            noteString = NOTE_NAMES[voicePool.getNote(i)];
+            noteString += std::to_string(voicePool.getOctave(i));
+
+            u8g2.setCursor(2 + 13*nonzero, 19);
+            u8g2.print(noteString.c_str());
+            nonzero++;
         }
-        xSemaphoreGive(notesPlayingMutex);
 
         u8g2.setFont(u8g2_font_ncenB08_tr);
         u8g2.setCursor(2, 30);
@@ -520,6 +736,7 @@ void displayUpdateTask(void * pvParameters) {
         //Toggle LED after updating display
         u8g2.sendBuffer(); // transfer internal memory to the display
         digitalToggle(LED_BUILTIN);
+        PROFILE_END(PROFILE_DISPLAY);
     }
 }
 
@@ -535,23 +752,84 @@ void joystickUpdateTask(void * pvParameters) {
         #ifndef TEST_JOYSTICK
         vTaskDelayUntil(&xLastWakeTime, xFrequency);
         #endif
+        PROFILE_BEGIN(PROFILE_JOYSTICK);
 
         // Read Joystick
-        int32_t xInput = analogRead(JOYX_PIN); // UNUSED
+        int32_t xInput = analogRead(JOYX_PIN);
         int32_t yInput = analogRead(JOYY_PIN);
 
+        // Filter cutoff - knob 0 setting swept by the joystick, coefficients follow in the renderer
+        uint8_t cutoff = filterCutoffIndex(sysState.getCutoff(), xInput);
+        __atomic_store_n(&filterCutoff, cutoff, __ATOMIC_RELAXED);
+
         // Vibrato
-        xSemaphoreTake(notesPlayingMutex, portMAX_DELAY);
-        for (int i = 0; i < ACCUMULATORS; i++) {
-            if (notesPlaying[i][0] != 999) {
-                uint32_t vibratoStepSize = vibratoFunc(stepSizes, notesPlaying[i][0], yInput);
-                __atomic_store_n(&currentStepSize[i], vibratoStepSize,__ATOMIC_RELAXED);
-            } else { __atomic_store_n(&currentStepSize[i], 0, __ATOMIC_RELAXED); }
-        }
-        xSemaphoreGive(notesPlayingMutex);
+        uint32_t bend = bendMultiplier(yInput); // Q16, shared by every voice
+        __atomic_store_n(&pitchBend, bend, __ATOMIC_RELAXED);
+        voicePool.retune(bend, vibratoFunc); // only walks the active voices
+        PROFILE_END(PROFILE_JOYSTICK);
     }
 }
 
+//Thread Task - Renders audio blocks whenever sampleISR frees a half of the double buffer
+void audioRenderTask(void * pvParameters) {
+    #ifndef TEST_RENDER
+    while (1)
+    #endif
+    {
+        #ifndef TEST_RENDER
+        StereoSample* block = audioBuffer.beginWrite(); // waits for the buffers to swap
+        #else
+        static StereoSample block[SAMPLE_BUFFER_SIZE];
+        #endif
+        PROFILE_BEGIN(PROFILE_RENDER);
+        renderBlock(block);
+        #ifndef TEST_RENDER
+        audioBuffer.endWrite();
+        #endif
+        #ifdef TRACE_LATENCY
+        latencyTrace.rendered(traceClock.now()); // new notes are heard from the next buffer swap
+        #endif
+        PROFILE_END(PROFILE_RENDER);
+    }
+}
+
+//Joins a running stack that has given this board its octave - ends the handshake if it is still
+// running, and asks the receiver for the stack's state, which also tells this board it is not the receiver
+// when it has finished a handshake of its own first
+void joinStack() {
+    #ifndef TEST_DECODE
+    if (__atomic_exchange_n(&handshaking, false, __ATOMIC_RELAXED)) {
+        #ifndef SHOW_STACK_WATERMARKS
+        vTaskDelete(handshakeHandle);
+        #else
+        vTaskSuspend(handshakeHandle);
+        #endif
+        vTaskResume(scanKeysHandle);
+    }
+    #endif
+    joining = true;
+    sendMsg('R');
+}
+
+//Checks the generation of a settings change - ones older than the last change to the same setting are
+// dropped, and a gap means changes were missed, so the receiver is asked for the whole state. Of two
+// changes to a setting with the same generation, the lower source wins on every board, see SysState::acceptDelta
+bool acceptDelta(const uint8_t msg[8]) {
+    int8_t ahead = msg[2] - sysState.getGeneration(); // wraps
+    if (ahead > 1 && !sysState.isReceiver()) { sendMsg('R'); }
+    return sysState.acceptDelta(msg[0], msg[2], msg[1]);
+}
+
+//Moves the settings knobs to the settings taken from a snapshot
+void loadSettingsKnobs() {
+    knobs[1].setRotation(sysState.getWaveform());
+    initKnob(1);
+    knobs[3].setRotation(sysState.getVolume());
+    initKnob(3);
+    knobs[0].setRotation(sysState.isKnob0Filter() ? sysState.getCutoff() : sysState.getEnvelope());
+    initKnob(0);
+}
+
 //Thread Task - Decodes Messages
 void decodeMessageTask(void * pvParameters) {
     uint8_t RX_Message_local[8] = {0};
@@ -560,94 +838,129 @@ void decodeMessageTask(void * pvParameters) {
     #endif
     {
         xQueueReceive(msgInQ, &RX_Message_local, portMAX_DELAY); // the decoding happens here - feeds in from msgInQ to RX_Message
-
-        // Decoding Messages
-        if (RX_Message_local[0] == 'P' || RX_Message_local[0] == 'R') { // Pressed or Released
-           xQueueSend(notePlayingQ, RX_Message_local, portMAX_DELAY);
-        } else if (RX_Message_local[0] == 'N') { // New handshake
-            if (eTaskGetState(handshakeHandle) == eReady) {
-                sysState.setHighestOctave(RX_Message_local[1]);
-            }
-        } else if (RX_Message_local[0] == 'F') { // Final handshake
-            if (eTaskGetState(handshakeHandle) == eReady) {
-                #ifndef SHOW_STACK_WATERMARKS
-                vTaskDelete(handshakeHandle);
-                #else
-                vTaskSuspend(handshakeHandle);
-                #endif
-                assignOctaves(RX_Message_local[1], sysState.getOctave());
-                vTaskResume(scanKeysHandle);
-            }
+        PROFILE_BEGIN(PROFILE_DECODE);
+        TRACE_EVENT(EVENT_QUEUE_RECEIVE, QUEUE_MSG_IN, RX_Message_local[0]);
+
+        // Decoding Messages - key frames go from CAN_RX_KEYS_ISR to playNotesTask instead
+        // N and F only arrive here after this board's handshake has ended, and are ignored
+        uint8_t type = RX_Message_local[0];
+        bool delta = type == 'V' || type == 'W' || type == 'E' || type == 'C' || type == 'M';
+        if (delta && !acceptDelta(RX_Message_local)) { // older than the settings here
         } else if (RX_Message_local[0] == 'V') { // Volume
             sysState.setVolume(RX_Message_local[3]);
             knobs[3].setRotation(RX_Message_local[3]);
-            knobs[3].init(3);
+            initKnob(3);
         } else if (RX_Message_local[0] == 'W') { // Waveform
             sysState.setWaveform(RX_Message_local[3]);
             knobs[1].setRotation(RX_Message_local[3]);
-            knobs[1].init(3);
+            initKnob(1);
+        } else if (RX_Message_local[0] == 'E') { // Envelope
+            sysState.setEnvelope(RX_Message_local[3]);
+            if (!sysState.isKnob0Filter()) {
+                knobs[0].setRotation(RX_Message_local[3]);
+                initKnob(0);
+            }
+        } else if (RX_Message_local[0] == 'C') { // Filter cutoff
+            sysState.setCutoff(RX_Message_local[3]);
+            if (sysState.isKnob0Filter()) {
+                knobs[0].setRotation(RX_Message_local[3]);
+                initKnob(0);
+            }
+        } else if (RX_Message_local[0] == 'M') { // Filter mode
+            sysState.setFilterMode(RX_Message_local[3]);
         } else if (RX_Message_local[0] == 'H') { // Highest octave
             sysState.setHighestOctave(RX_Message_local[1]);
             if (resetConnsRead() == 2 && RX_Message_local[2]) { // if eastmost keyboard and assignment
-                #ifndef TEST_DECODE
-                #ifndef SHOW_STACK_WATERMARKS
-                vTaskDelete(handshakeHandle);
-                #else
-                vTaskSuspend(handshakeHandle);
-                #endif
-                vTaskResume(scanKeysHandle);
-                #endif
                 sysState.setOctave(RX_Message_local[1]);
+                __atomic_store_n(&keySource, RX_Message_local[1], __ATOMIC_RELAXED);
                 knobs[2].setRotation(RX_Message_local[1]);
-                knobs[2].init(2);
+                initKnob(2);
+                joinStack();
             }
         } else if (RX_Message_local[0] == 'L') { // Lowest octave
             sysState.setLowestOctave(RX_Message_local[1]);
             if (resetConnsRead() == 1 && RX_Message_local[2]) { // if westmost keyboard and assignment
-                #ifndef TEST_DECODE
-                #ifndef SHOW_STACK_WATERMARKS
-                vTaskDelete(handshakeHandle);
-                #else
-                vTaskSuspend(handshakeHandle);
-                #endif
-                vTaskResume(scanKeysHandle);
-                #endif
                 sysState.setOctave(RX_Message_local[1]);
+                __atomic_store_n(&keySource, RX_Message_local[1], __ATOMIC_RELAXED);
                 knobs[2].setRotation(RX_Message_local[1]);
-                knobs[2].init(2);
+                initKnob(2);
+                joinStack();
             }
         } else if (RX_Message_local[0] == 'T') { // Transmitter
             sysState.setReceiver(false);
             sysState.setReceiverOctave(RX_Message_local[1]);
+        } else if (RX_Message_local[0] == 'A') { // State snapshot
+            bool join = __atomic_load_n(&handshaking, __ATOMIC_RELAXED) || joining;
+            if (sysState.applySnapshot(RX_Message_local, join)) { loadSettingsKnobs(); }
+            if (join && RX_Message_local[1] == STATE_VERSION) { joining = false; }
+        } else if (RX_Message_local[0] == 'R') { // Snapshot request
+            if (sysState.isReceiver()) { sendSnapshot(); }
         }
+        PROFILE_END(PROFILE_DECODE);
     }
 }
 
-//Thread Task - Transmits Messages
-void transmitMessageTask (void * pvParameters) {
-	uint8_t msgOut[8] = {0};
-    #ifndef TEST_TRANSMIT
-	while (1)
-    #endif
-    {
-		xQueueReceive(msgOutQ, &msgOut, portMAX_DELAY); // wait until outgoing message
-        #ifndef TEST_TRANSMIT
-        if (sysState.getConns() > 0)
-        #else
-        delayMicroseconds(900);
-        #endif
-        { // only sends if there are connections
-            xSemaphoreTake(CAN_TX_Semaphore, portMAX_DELAY); // wait until semaphore can be taken
-            CAN_TX(0x123, msgOut); // send
+//Thread Task - Applies the connection changes scanKeysTask sees, so hot-plugging never holds up the scan
+// A reading has to hold for CONN_TIME, as the detect inputs bounce while a board is plugged in
+// i.e 1 -> 2 is actually 1 -> 0 -> 2 or 1 -> 0 -> 2 -> 0 -> 2 etc.
+// Disconnections are sent straight away. A new board is sent the settings and octave range
+// CONN_BOOT_TIME later, when it has started, unless it is unplugged again first.
+void connectionsTask(void * pvParameters) {
+    uint8_t reading = 0;    // latest from scanKeysTask
+    uint8_t connecting = 0; // connections waiting for a new board to start
+    bool changed = false;
+    bool booting = false;
+    TickType_t changeTime = 0;
+    TickType_t connectTime = 0;
+    while (1) {
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+        if (changed) { wait = CONN_TIME - std::min(now - changeTime, CONN_TIME); }
+        if (booting) { wait = std::min(wait, CONN_BOOT_TIME - std::min(now - connectTime, CONN_BOOT_TIME)); }
+        if (xQueueReceive(connsQ, &reading, wait) == pdTRUE) {
+            changeTime = xTaskGetTickCount();
+            changed = true;
+            continue;
+        }
+        PROFILE_BEGIN(PROFILE_CONNECTIONS);
+        now = xTaskGetTickCount();
+        if (changed && (now - changeTime) >= CONN_TIME) {
+            changed = false;
+            uint8_t conns = sysState.getConns();
+            booting = reading & ~conns;
+            if (booting) { // New Board Connected
+                connecting = reading;
+                connectTime = now;
+            } else if (reading != conns) { // Disconnection
+                updateConnections(reading);
+            }
         }
-	}
+        if (booting && (now - connectTime) >= CONN_BOOT_TIME) {
+            booting = false;
+            updateConnections(connecting);
+        }
+        PROFILE_END(PROFILE_CONNECTIONS);
+    }
+}
+
+//Thread Task - Streams the event trace over Serial, lowest priority so it only uses idle time
+void traceDrainTask(void * pvParameters) {
+    const TickType_t xFrequency = 10/portTICK_PERIOD_MS;
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        PROFILE_BEGIN(PROFILE_TRACE_DRAIN);
+        while (traceRing.drainToSerial() >= TRACE_BATCH) {} // until the ring is empty
+        PROFILE_END(PROFILE_TRACE_DRAIN);
+    }
 }
 
 //Audio Interrupt Timer
 void setAudioInterrups() {
+    audioOutInit();
     TIM_TypeDef *Instance = TIM1;
     HardwareTimer *sampleTimer = new HardwareTimer(Instance);
-    sampleTimer->setOverflow(22000, HERTZ_FORMAT);
+    sampleTimer->setOverflow(SAMPLE_RATE, HERTZ_FORMAT);
     sampleTimer->attachInterrupt(sampleISR);
     sampleTimer->resume();
 }
@@ -660,8 +973,10 @@ void CAN_ConfigStart() {
     #else
     CAN_Init(false);
     #endif
-    setCANFilter(0x123, 0x7ff); // only accepts messages from address 0x123 (0x7ff is the mask - match all bits)
-    CAN_RegisterRX_ISR(CAN_RX_ISR);
+    setCANFilter(CAN_FAST_ID, CAN_FAST_MASK, 0, 0); // bank 0 - key frames and syncs to FIFO 0
+    setCANFilter(0, 0, 1, 1);                       // bank 1 - everything else to FIFO 1
+    CAN_RegisterRX_ISR(CAN_RX_KEYS_ISR, 0);
+    CAN_RegisterRX_ISR(CAN_RX_ISR, 1);
     CAN_RegisterTX_ISR(CAN_TX_ISR);
     CAN_Start();
     #endif
@@ -670,38 +985,50 @@ void CAN_ConfigStart() {
 void setup() {
     setPinDirections();
 
+    #ifdef PROFILE_TASKS
+    cycleCounterInit();
+    #endif
+    #ifdef TRACE_LATENCY
+    latencyTrace.begin();
+    #endif
+    #ifdef TRACE_EVENTS
+    cycleCounterInit();
+    traceRing.begin();
+    #endif
+
     //Initialise Display
-    initOutMuxBits();
+    keyMatrix.begin();
     u8g2.begin();
 
     //Initialise Audio
-    #ifndef DISABLE_SOUND
+    #if !defined(DISABLE_SOUND) && !defined(TEST_SAMPLE_ISR)
     setAudioInterrups();
+    #elif defined(TEST_SAMPLE_ISR)
+    audioOutInit(); // sampleISR is called from loop() instead of the timer
     #endif
 
     //Initialise CAN
     CAN_ConfigStart();
 
-    notesPlayingMutex = xSemaphoreCreateMutex();
-
     //Initialise UART
+    #ifndef TRACE_EVENTS
     Serial.begin(9600);
+    #else
+    Serial.begin(TRACE_BAUD); // binary stream - decode with host/tools/trace_decode.cpp
+    #endif
     Serial.println("Hello World");
 
     msgInQ = xQueueCreate(36,8); // CAN incoming message queue - 36 items, 8 bytes each
-    msgOutQ = xQueueCreate(36,8);
-    CAN_TX_Semaphore = xSemaphoreCreateCounting(3,3); // counting semaphore as can transmit 3 at a time
     notePlayingQ = xQueueCreate(36,8);
+    handshakeQ = xQueueCreate(8,8); // a claim from every other board of a full stack
+    connsQ = xQueueCreate(8,1);
+    handshakeAck = xSemaphoreCreateBinary();
 
     #ifdef TEST_PLAYNOTES
     uint8_t msgOut[8] = {0};
-    msgOut[0] = 'P';
-    msgOut[1] = 4;
-    msgOut[2] = 5;
-    for (int i = 0; i < 32; i++) {
-        msgOut[0] = (int(i/2) % 2 == 1) ? 'P' : 'R';
-        msgOut[1] = int(i/2) % 3 + 3;
-        msgOut[2] = int(i/2) % 12;
+    for (int i = 0; i < 32; i++) { // worst case - all 12 notes start or stop
+        uint16_t notes = (i % 2 == 0) ? 0xFFF : 0;
+        packKeyFrame(msgOut, i % 3 + 3, i % 3 + 3, i, notes, notes);
         xQueueSend(notePlayingQ, msgOut, portMAX_DELAY);
     }
     #endif
@@ -719,19 +1046,15 @@ void setup() {
     }
     #endif
 
-    #ifdef TEST_TRANSMIT
-    uint8_t msgOut[8] = {0};
-    msgOut[0] = 'P';
-    msgOut[1] = 4;
-    msgOut[2] = 5;
-    for (int i = 0; i < 32; i++) {
-        msgOut[0] = 'L';
-        msgOut[1] = 7;
-        msgOut[2] = 1;
-        xQueueSend(msgOutQ, msgOut, portMAX_DELAY);
+    #ifdef TEST_RENDER
+    for (int i = 0; i < ACCUMULATORS; i++) { // worst case - every voice active
+        voicePool.noteOn(4 + i / 12, i % 12, stepSizeFor(4 + i / 12, i % 12));
     }
     #endif
 
+    knobs[0].setUpperLimit(ENVELOPE_SETTINGS - 1);
+    knobs[0].setLowerLimit(0);
+
     knobs[1].setUpperLimit(3);
     knobs[1].setLowerLimit(0);
 
@@ -753,7 +1076,7 @@ void setup() {
         "scanKeys",     /* Text name for the task */
         SCANKEYS_SIZE,  /* Stack size in bytes */
         NULL,	        /* Parameter passed into the task */
-        2,			    /* Task priority */
+        6,			    /* Task priority - highest, shortest period (1 ms sample) */
         &scanKeysHandle /* Pointer to store the task handle */
     );
 
@@ -794,15 +1117,34 @@ void setup() {
     );
 
     xTaskCreate(
-        transmitMessageTask,   /* Function that implements the task */
-        "transmitMessage",     /* Text name for the task */
-        TRANSMIT_SIZE,           /* Stack size in bytes */
-        NULL,			       /* Parameter passed into the task */
-        1,			           /* Task priority */
-        &transmitMessageHandle /* Pointer to store the task handle */
+        connectionsTask,   /* Function that implements the task */
+        "connections",     /* Text name for the task */
+        CONNECTIONS_SIZE,  /* Stack size in bytes */
+        NULL,              /* Parameter passed into the task */
+        1,                 /* Task priority */
+        &connectionsHandle /* Pointer to store the task handle */
+    );
+
+    xTaskCreate(
+        audioRenderTask,   /* Function that implements the task */
+        "audioRender",     /* Text name for the task */
+        RENDER_SIZE,       /* Stack size in bytes */
+        NULL,              /* Parameter passed into the task */
+        5,                 /* Task priority - shortest deadline (one block period) */
+        &audioRenderHandle /* Pointer to store the task handle */
     );
+    #ifdef TRACE_EVENTS
+    xTaskCreate(
+        traceDrainTask,   /* Function that implements the task */
+        "traceDrain",     /* Text name for the task */
+        TRACE_DRAIN_SIZE, /* Stack size in bytes */
+        NULL,             /* Parameter passed into the task */
+        0,                /* Task priority - below every other task */
+        &traceDrainHandle /* Pointer to store the task handle */
+    );
+    #endif
     #else
-    for (int i = 0; i < 4; i++) { knobs[i].init(i); }
+    for (int i = 0; i < 4; i++) { initKnob(i); }
     knobs[2].setRotation(4);
     sysState.setReceiver(true);
     #endif
@@ -812,7 +1154,7 @@ void setup() {
 }
 
 #ifdef SHOW_STACK_WATERMARKS
-int hsStackMax, skStackMax, pnStackMax, juStackMax, duStackMax, dmStackMax, tmStackMax;
+int hsStackMax, skStackMax, pnStackMax, juStackMax, duStackMax, dmStackMax;
 #endif
 void loop() {
     #ifdef SHOW_STACK_WATERMARKS
@@ -828,8 +1170,6 @@ void loop() {
     duStackMax = (duStack > duStackMax) ? (DISPLAY_SIZE - duStack) : duStackMax;
     int dmStack = uxTaskGetStackHighWaterMark(decodeMessageHandle);
     dmStackMax = (dmStack > dmStackMax) ? (DECODE_SIZE - dmStack) : dmStackMax;
-    int tmStack = uxTaskGetStackHighWaterMark(transmitMessageHandle);
-    dmStackMax = (tmStack > tmStackMax) ? (TRANSMIT_SIZE - tmStack) : tmStackMax;
 
     Serial.print("Highest Stack Size used for handshake:       ");
     Serial.print(hsStackMax);
@@ -849,9 +1189,52 @@ void loop() {
     Serial.print("Highest Stack Size used for decodeMessage:   ");
     Serial.print(dmStackMax);
     Serial.println(" bytes");
-    Serial.print("Highest Stack Size used for transmitMessage: ");
-    Serial.print(tmStackMax);
-    Serial.println(" bytes");
+    #endif
+
+    #ifdef PROFILE_TASKS
+    static uint32_t lastProfilePrint = 0;
+    if (millis() - lastProfilePrint >= 5000) { // loop() runs in the idle task - print every 5 s
+        lastProfilePrint = millis();
+        for (int i = 0; i < PROFILE_SLOTS; i++) {
+            if (profiles[i].getCount()) { profiles[i].print(PROFILE_NAMES[i]); }
+        }
+        scanJitter.print("scanJitter");
+        if (scanJitter.getMax() > SCAN_JITTER_LIMIT_US * (F_CPU / 1000000)) { Serial.println("scanJitter over SCAN_JITTER_LIMIT_US, samples were skipped"); }
+    }
+    #endif
+
+    #ifdef TRACE_LATENCY
+    static uint32_t lastTracePrint = 0;
+    if (millis() - lastTracePrint >= 5000) {
+        lastTracePrint = millis();
+        latencyTrace.print();
+    }
+    #endif
+
+    #ifdef SHOW_UNDERRUNS
+    Serial.print("Audio buffer underruns: ");
+    Serial.println(audioBuffer.getUnderruns());
+    #endif
+
+    #ifdef SHOW_CAN_ERRORS
+    static uint32_t lastCANPrint = 0;
+    if (millis() - lastCANPrint >= 5000) {
+        lastCANPrint = millis();
+        for (uint32_t fifo = 0; fifo < 2; fifo++) {
+            Serial.print("CAN FIFO ");
+            Serial.print(fifo);
+            Serial.print(" overruns: ");
+            Serial.print(CAN_GetOverruns(fifo));
+            Serial.print(", queue full drops: ");
+            Serial.println(__atomic_load_n(&canRxDropped[fifo], __ATOMIC_RELAXED));
+        }
+        Serial.print("CAN transmit ring waiting: ");
+        Serial.print(CAN_GetTxLevel());
+        Serial.print(", most waiting: ");
+        Serial.print(CAN_GetTxHighWater());
+        Serial.print(", dropped: ");
+        Serial.println(CAN_GetTxDropped());
+    }
     #endif
 
     #ifdef TEST_HANDSHAKE
@@ -909,11 +1292,36 @@ void loop() {
     #endif
 
     #ifdef TEST_TRANSMIT
+        uint8_t msgOut[8] = {'L', 7, 1};
         uint32_t startTime = micros();
-        for (int iter = 0; iter < 32; iter++) {
-            transmitMessageTask(NULL);
+        for (int iter = 0; iter < 32; iter++) { // fills the transmit ring - no waiting for the bus
+            CAN_TX(canMessageId(msgOut[0], 4), msgOut);
         }
         Serial.println(micros()-startTime);
         while(1);
     #endif
+
+    #ifdef TEST_RENDER
+        uint32_t startTime = micros();
+        for (int iter = 0; iter < 32; iter++) {
+            audioRenderTask(NULL);
+        }
+        uint32_t elapsed = micros()-startTime;
+        Serial.println(elapsed);
+        Serial.print("Cycles per sample: ");
+        Serial.println(elapsed * (F_CPU / 1000000) / (32 * SAMPLE_BUFFER_SIZE));
+        while(1);
+    #endif
+
+    #ifdef TEST_SAMPLE_ISR // compare with AUDIO_ANALOGWRITE defined for the cost of the old output path
+        uint32_t startTime = micros();
+        for (uint32_t iter = 0; iter < 32 * SAMPLE_BUFFER_SIZE; iter++) {
+            sampleISR();
+        }
+        uint32_t elapsed = micros()-startTime;
+        Serial.println(elapsed);
+        Serial.print("Cycles per sample: ");
+        Serial.println(elapsed * (F_CPU / 1000000) / (32 * SAMPLE_BUFFER_SIZE));
+        while(1);
+    #endif
 }
\ No newline at end of file